@@ -16,6 +16,24 @@
 #pragma once
 #include "l_container.hpp"
 
+// slots per bucket in a thread's magazine, refills and flushes move half of that at a time
+#ifndef LOFI_MAGAZINE_SIZE
+#define LOFI_MAGAZINE_SIZE 64
+#endif
+
+// most a single magazine holds on to, buckets of big blocks get fewer slots and the biggest none
+#ifndef LOFI_MAGAZINE_BYTES
+#define LOFI_MAGAZINE_BYTES KB(64)
+#endif
+
+#ifndef FORCENOINLINE
+#if COMPILER_CL
+#define FORCENOINLINE __declspec(noinline)
+#else
+#define FORCENOINLINE __attribute__((noinline))
+#endif
+#endif
+
 
 namespace lofi {
  
@@ -157,6 +175,79 @@ namespace lofi {
           };
       };
 
+    // maps a pointer to the bucket it came from with one shift and one table load. buckets
+    // sit back to back in a single block, so every bucket's offset is known at compile time.
+    // a granule is never bigger than the smallest bucket, it holds at most one bucket start
+    // and one compare against that start settles the bucket. Padded is for pools that leave
+    // block_align bytes behind each bucket
+    template<size_t ID, b8 Padded>
+      struct bucket_map {
+        using info = bucket_info<ID>;
+        static constexpr size_t bucket_count = info::bucket_count;
+        static constexpr size_t table_count = bucket_count ? bucket_count : 1;
+        static_assert(bucket_count < MAX_u8, "bucket_map indexes buckets with a byte");
+
+        static constexpr size_t span(size_t index) {
+          constexpr auto sizes = index_array<typename info::apply_block_size_seq::type>;
+          constexpr auto counts = index_array<typename info::apply_block_count_seq::type>;
+          constexpr auto aligns = index_array<typename info::apply_block_align_seq::type>;
+          return sizes[index] * counts[index] + (Padded ? aligns[index] : 0);
+        }
+
+        static constexpr size_t total = []() {
+          size_t sum = 0;
+          for(size_t i = 0; i < bucket_count; i++) {
+            sum += span(i);
+          }
+          return sum;
+        }();
+
+        static constexpr size_t granule_shift = []() {
+          size_t smallest = MAX_u64;
+          for(size_t i = 0; i < bucket_count; i++) {
+            smallest = MIN(smallest, span(i));
+          }
+          size_t shift = 0;
+          while(bucket_count && (2ull << shift) <= smallest) {
+            shift++;
+          }
+          return shift;
+        }();
+
+        static constexpr size_t granule_count = (total >> granule_shift) + 1;
+
+        struct tables {
+          size_t ends[table_count] = {};
+          u8 granules[granule_count] = {};      // bucket holding the granule's first byte
+        };
+
+        static constexpr tables table = []() {
+          tables result{};
+          size_t end = 0;
+          for(size_t i = 0; i < bucket_count; i++) {
+            end += span(i);
+            result.ends[i] = end;
+          }
+          size_t bucket = 0;
+          for(size_t g = 0; g < granule_count; g++) {
+            while(bucket + 1 < bucket_count && (g << granule_shift) >= result.ends[bucket]) {
+              bucket++;
+            }
+            result.granules[g] = (u8)bucket;
+          }
+          return result;
+        }();
+
+        // bucket index for a byte offset into the pool's block, MAX_u64 outside of every bucket
+        static constexpr size_t find(const size_t offset) {
+          if(offset >= total) {
+            return MAX_u64;
+          }
+          const size_t index = table.granules[offset >> granule_shift];
+          return offset < table.ends[index] ? index : index + 1;
+        }
+      };
+
     template<size_t ID>
       struct StaticMemoryPool : StackAllocPolicy<bucket_info<ID>::set_size, 1024>
                                 , make_pool<ID> 
@@ -171,6 +262,10 @@ namespace lofi {
         auto& get() {
           return static_cast<meta::at_t<list_t, Index>&>(*this);
         }
+      // bucket_map offsets are counted from here
+      void* get_base() const {
+        return alloc_t::data();
+      }
       private:
       void set_pointers() {
         u8* start = (u8*)alloc_t::data();
@@ -221,6 +316,10 @@ namespace lofi {
         auto& get() {
           return static_cast<meta::at_t<list_t, Index>&>(*this);
         }
+      // bucket_map offsets are counted from here
+      void* get_base() const {
+        return alloc_t::data();
+      }
       private:
       void set_pointers() {
         u8* start = (u8*)alloc_t::data();
@@ -408,7 +507,18 @@ namespace lofi {
       return _dispatcher(FWD(func(size)));
     }
 
+    // the only bucket ptr can be in is looked up, belongs() still rejects the padding
+    // between buckets
+    static size_t find_bucket_index(void* ptr) {
+      const size_t offset = (size_t)(PTR2INT(ptr) - PTR2INT(mem::get_pool<ID>().get_base()));
+      return mem::bucket_map<ID, true>::find(offset);
+    }
+
     static b8 free(void* ptr) {
+      const size_t index = find_bucket_index(ptr);
+      if(index == MAX_u64) {
+        return false;
+      }
       dispatcher _dispatcher{ IdxV<mem::bucket_info<ID>::bucket_count>
                             , [&]<size_t Index>(IdxT<Index>){
                               if(mem::get_pool<ID>().template get<Index>().belongs(ptr)) {
@@ -417,11 +527,7 @@ namespace lofi {
                               }
                               return false;
                             }};
-      for(size_t i = 0; i < mem::bucket_info<ID>::bucket_count; i++) {
-        if(_dispatcher(i)) 
-          return true;
-      }
-      return false;
+      return _dispatcher(index);
     }
 
     static void* reallocate(void* ptr, size_t size, size_t alignment = DEFAULT_ALIGNMENT) {
@@ -435,12 +541,8 @@ namespace lofi {
       
       size = MAX(size, alignment);
       void* new_ptr = allocate(size);
-      size_t old_size{};
-      for(size_t i = 0; i < mem::bucket_info<ID>::bucket_count; i++) {
-        old_size = _dispatcher(i);
-        if(old_size)
-          break;
-      }
+      const size_t index = find_bucket_index(ptr);
+      size_t old_size = index == MAX_u64 ? 0 : _dispatcher(index);
       L_ASSERT(new_ptr != nullptr);
       old_size = MIN(size, old_size);
       MEM_COPY(new_ptr, ptr, old_size);
@@ -457,14 +559,14 @@ namespace lofi {
     static T* allocate() {
       static constexpr size_t N = sizeof(T);
       static constexpr size_t I = apply_find_bucket<ID, N>::value;
-      return (T*)FWD(mem::get_lock_free_pool<ID>().template get<I>().add_object());
+      return (T*)FWD(mem::get_lock_free_pool<ID>().template get<I>().get_object());
     }
     
     template<size_t ID, typename T>
     static b8 deallocate(T* ptr) {
       static constexpr size_t N = sizeof(T);
       static constexpr size_t I = apply_find_bucket<ID, N>::value;
-      if(mem::get_lock_free_pool<ID>().template get<I>().remove_object(static_cast<void*>(FWD(ptr)))) 
+      if(mem::get_lock_free_pool<ID>().template get<I>().return_object(static_cast<void*>(FWD(ptr)))) 
         return true;
       return false;
     }
@@ -516,40 +618,34 @@ namespace lofi {
       return _dispatcher(FWD(func(size)));
     }
 
+    // lock free buckets have no padding, whatever the map finds is the bucket
+    static size_t find_bucket_index(void* ptr) {
+      const size_t offset = (size_t)(PTR2INT(ptr) - PTR2INT(mem::get_lock_free_pool<ID>().get_base()));
+      return mem::bucket_map<ID, false>::find(offset);
+    }
+
     static b8 free(void* ptr) {
+      const size_t index = find_bucket_index(ptr);
+      if(index == MAX_u64) {
+        return false;
+      }
       dispatcher _dispatcher{ IdxV<mem::bucket_info<ID>::bucket_count>
                             , [&]<size_t Index>(IdxT<Index>){
-                              if(mem::get_lock_free_pool<ID>().template get<Index>().belongs(ptr)) {
-                                using BlockType = typename mem::LockFreeStaticMemoryPool<ID>::template type_at_index<Index>;
-                                mem::get_lock_free_pool<ID>().template get<Index>().return_object(ptr);
-                                return true;
-                              }
-                              return false;
+                              return mem::get_lock_free_pool<ID>().template get<Index>().return_object(ptr);
                             }};
-      for(size_t i = 0; i < mem::bucket_info<ID>::bucket_count; i++) {
-        if(_dispatcher(i)) 
-          return true;
-      }
-      return false;
+      return _dispatcher(index);
     }
 
     static void* reallocate(void* ptr, size_t size, size_t alignment = DEFAULT_ALIGNMENT) {
       dispatcher _dispatcher{ IdxV<mem::bucket_info<ID>::bucket_count>
                             , [&]<size_t Index>(IdxT<Index>){
-                              if(mem::get_lock_free_pool<ID>().template get<Index>().belongs(ptr)) {
-                                return mem::get_lock_free_pool<ID>().template get<Index>().get_object_size();
-                              }
-                              return (size_t)0;
+                              return mem::get_lock_free_pool<ID>().template get<Index>().get_object_size();
                             }};
       
       size = MAX(size, alignment);
       void* new_ptr = allocate(size);
-      size_t old_size{};
-      for(size_t i = 0; i < mem::bucket_info<ID>::bucket_count; i++) {
-        old_size = _dispatcher(i);
-        if(old_size)
-          break;
-      }
+      const size_t index = find_bucket_index(ptr);
+      size_t old_size = index == MAX_u64 ? 0 : _dispatcher(index);
       L_ASSERT(new_ptr != nullptr);
       old_size = MIN(size, old_size);
       MEM_COPY(new_ptr, ptr, old_size);
@@ -559,6 +655,286 @@ namespace lofi {
 
   };
 
+  // thread local magazines in front of LockFreeRuntimeAllocator<ID>. allocate and free only
+  // touch the calling thread's magazine for the block's bucket, the shared pool is hit once
+  // per half a magazine, popped one block at a time on a refill and pushed back as a single
+  // chain on a flush. a thread's magazines are flushed when it exits. blocks may be freed on
+  // any thread, they go to the freeing thread's magazine. with many threads the magazines can
+  // hold every free block of a bucket between them, a request then takes a larger block
+  template<size_t ID>
+  class MagazineAllocator {
+  public:
+    using shared_t = LockFreeRuntimeAllocator<ID>;
+    using info_t = mem::bucket_info<ID>;
+    static constexpr size_t bucket_count = info_t::bucket_count;
+
+    static void* allocate(size_t size, size_t alignment = 0) {
+      size = MAX(size, alignment);
+      for(size_t index = find_size_index(size); index < bucket_count; index++) {
+        void* block = allocate_from(index);
+        if(block) {
+          return block;
+        }
+      }
+      return nullptr;
+    }
+
+    static b8 free(void* ptr) {
+      const size_t index = shared_t::find_bucket_index(ptr);
+      if(index == MAX_u64) {
+        return false;
+      }
+      if(!capacities[index]) {
+        return shared_t::free(ptr);
+      }
+      magazine& mag = get_cache().magazines[index];
+      if(mag.count == capacities[index]) {
+        flush(mag, index, batch_size(index));
+      }
+      mag.slots[mag.count++] = ptr;
+      return true;
+    }
+
+    static void* reallocate(void* ptr, size_t size, size_t alignment = DEFAULT_ALIGNMENT) {
+      size = MAX(size, alignment);
+      void* new_ptr = allocate(size);
+      const size_t index = shared_t::find_bucket_index(ptr);
+      size_t old_size = index == MAX_u64 ? 0 : sizes[index];
+      L_ASSERT(new_ptr != nullptr);
+      old_size = MIN(size, old_size);
+      MEM_COPY(new_ptr, ptr, old_size);
+      free(ptr);
+      return new_ptr;
+    }
+
+    // hands every block cached by the calling thread back to the shared pool
+    static void flush_thread() {
+      thread_cache& cache = get_cache();
+      for(size_t i = 0; i < bucket_count; i++) {
+        flush(cache.magazines[i], i, cache.magazines[i].count);
+      }
+    }
+
+    static constexpr size_t get_capacity(size_t index) {
+      return capacities[index];
+    }
+
+  private:
+    static constexpr auto sizes = index_array<typename info_t::apply_block_size_seq::type>;
+
+    struct capacity_table {
+      size_t values[bucket_count ? bucket_count : 1] = {};
+
+      constexpr size_t operator[](size_t index) const {
+        return values[index];
+      }
+    };
+
+    // a magazine never holds more than a 16th of its bucket
+    static constexpr capacity_table capacities = []() {
+      constexpr auto counts = index_array<typename info_t::apply_block_count_seq::type>;
+      capacity_table result{};
+      for(size_t i = 0; i < bucket_count; i++) {
+        result.values[i] = MIN(MIN((size_t)LOFI_MAGAZINE_SIZE, (size_t)LOFI_MAGAZINE_BYTES / sizes[i]), counts[i] / 16);
+      }
+      return result;
+    }();
+
+    struct magazine {
+      size_t count = 0;
+      void* slots[LOFI_MAGAZINE_SIZE];
+    };
+
+    struct thread_cache {
+      magazine magazines[bucket_count ? bucket_count : 1];
+
+      ~thread_cache() {
+        for(size_t i = 0; i < bucket_count; i++) {
+          flush(magazines[i], i, magazines[i].count);
+        }
+      }
+    };
+
+    // never inlined, a fiber that moved to another thread between two calls must not reuse the
+    // last thread's cache address
+    FORCENOINLINE static thread_cache& get_cache() {
+      thread_local thread_cache cache;
+      return cache;
+    }
+
+    static size_t find_size_index(size_t size) {
+      for(size_t i = 0; i < bucket_count; i++) {
+        if(size <= sizes[i]) {
+          return i;
+        }
+      }
+      return MAX_u64;
+    }
+
+    static void* allocate_from(size_t index) {
+      if(!capacities[index]) {
+        return shared_t::allocate(sizes[index]);
+      }
+      magazine& mag = get_cache().magazines[index];
+      if(!mag.count) {
+        refill(mag, index);
+      }
+      return mag.count ? mag.slots[--mag.count] : nullptr;
+    }
+
+    static constexpr size_t batch_size(size_t index) {
+      return MAX(capacities[index] / 2, (size_t)1);
+    }
+
+    static void refill(magazine& mag, size_t index) {
+      dispatcher _dispatcher{ IdxV<bucket_count>
+                            , [&]<size_t Index>(IdxT<Index>){
+                              auto& bucket = mem::get_lock_free_pool<ID>().template get<Index>();
+                              const size_t target = batch_size(Index);
+                              while(mag.count < target) {
+                                void* block = (void*)bucket.get_object();
+                                if(!block) {
+                                  break;
+                                }
+                                mag.slots[mag.count++] = block;
+                              }
+                              return mag.count;
+                            }};
+      _dispatcher(index);
+    }
+
+    // the bottom count slots, the longest freed and coldest, go back linked through their
+    // first word
+    static void flush(magazine& mag, size_t index, size_t count) {
+      if(!count) {
+        return;
+      }
+      for(size_t i = 0; i + 1 < count; i++) {
+        *((void**)mag.slots[i]) = mag.slots[i + 1];
+      }
+      dispatcher _dispatcher{ IdxV<bucket_count>
+                            , [&]<size_t Index>(IdxT<Index>){
+                              mem::get_lock_free_pool<ID>().template get<Index>().return_objects(mag.slots[0], mag.slots[count - 1]);
+                              return true;
+                            }};
+      _dispatcher(index);
+      mag.count -= count;
+      MEM_COPY(mag.slots, mag.slots + count, mag.count * sizeof(void*));
+    }
+  };
+
+  // one RuntimeAllocator per thread, ids FirstID to FirstID + NumThreads - 1, each only ever
+  // touched by its own thread. a block freed on a thread that does not own it is pushed on the
+  // owner's remote free list, the owner puts those back in its pool on its next allocation.
+  // with a thread pool, size it for one more than the workers and pass GET_THREAD_SLOT, so
+  // threads outside the pool get the last allocator instead of sharing worker 0's. they share
+  // that one among themselves, so only one of them may allocate at a time
+  template<size_t FirstID, size_t NumThreads>
+  class PerThreadAllocator {
+  public:
+    static void* allocate(u64 thread_id, size_t size, size_t alignment = 0) {
+      reclaim(thread_id);
+      dispatcher _dispatcher{ IdxV<NumThreads>
+                            , [&]<size_t Index>(IdxT<Index>){
+                              return RuntimeAllocator<FirstID + Index>::allocate(size, alignment);
+                            }};
+      return _dispatcher(thread_id);
+    }
+
+    static b8 free(u64 thread_id, void* ptr) {
+      const u64 owner = find_owner(ptr);
+      if(owner == MAX_u64) {
+        return false;
+      }
+      if(owner != thread_id) {
+        get_remote_list(owner).push(ptr);
+        return true;
+      }
+      return free_local(owner, ptr);
+    }
+
+    static void* reallocate(u64 thread_id, void* ptr, size_t size, size_t alignment = DEFAULT_ALIGNMENT) {
+      size = MAX(size, alignment);
+      void* new_ptr = allocate(thread_id, size);
+      L_ASSERT(new_ptr != nullptr);
+      const size_t old_size = MIN(size, get_block_size(ptr));
+      MEM_COPY(new_ptr, ptr, old_size);
+      free(thread_id, ptr);
+      return new_ptr;
+    }
+
+    // puts every block other threads freed back into thread_id's pool, only thread_id may call it
+    static void reclaim(u64 thread_id) {
+      void* block = get_remote_list(thread_id).take_all();
+      while(block) {
+        void* next = *((void**)block);
+        free_local(thread_id, block);
+        block = next;
+      }
+    }
+
+    // the thread whose pool ptr came from, MAX_u64 when it came from none of them
+    static u64 find_owner(void* ptr) {
+      const u64 address = PTR2INT(ptr);
+      for(u64 i = 0; i < NumThreads; i++) {
+        if(address - get_ranges().begin[i] < set_size) {
+          return i;
+        }
+      }
+      return MAX_u64;
+    }
+
+  private:
+    static constexpr u64 set_size = mem::bucket_info<FirstID>::set_size;
+
+    struct pool_ranges {
+      u64 begin[NumThreads];
+    };
+
+    static const pool_ranges& get_ranges() {
+      static const pool_ranges ranges = []() {
+        dispatcher _dispatcher{ IdxV<NumThreads>
+                              , [&]<size_t Index>(IdxT<Index>){
+                                static_assert(mem::bucket_info<FirstID + Index>::set_size == set_size, "per thread pools need the same bucket set");
+                                return (u64)PTR2INT(mem::get_pool<FirstID + Index>().get_base());
+                              }};
+        pool_ranges result;
+        for(u64 i = 0; i < NumThreads; i++) {
+          result.begin[i] = _dispatcher(i);
+        }
+        return result;
+      }();
+      return ranges;
+    }
+
+    static remote_free_list& get_remote_list(u64 thread_id) {
+      static remote_free_list lists[NumThreads];
+      return lists[thread_id];
+    }
+
+    static b8 free_local(u64 thread_id, void* ptr) {
+      dispatcher _dispatcher{ IdxV<NumThreads>
+                            , [&]<size_t Index>(IdxT<Index>){
+                              return RuntimeAllocator<FirstID + Index>::free(ptr);
+                            }};
+      return _dispatcher(thread_id);
+    }
+
+    static size_t get_block_size(void* ptr) {
+      const u64 owner = find_owner(ptr);
+      if(owner == MAX_u64) {
+        return 0;
+      }
+      dispatcher _dispatcher{ IdxV<NumThreads>
+                            , [&]<size_t Index>(IdxT<Index>){
+                              constexpr auto sizes = index_array<typename mem::bucket_info<FirstID + Index>::apply_block_size_seq::type>;
+                              const size_t index = RuntimeAllocator<FirstID + Index>::find_bucket_index(ptr);
+                              return index == MAX_u64 ? (size_t)0 : sizes[index];
+                            }};
+      return _dispatcher(owner);
+    }
+  };
+
   namespace mem {
     using default_bucket_descriptor_set_t
           = List
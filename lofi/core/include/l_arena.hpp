@@ -219,6 +219,95 @@ namespace lofi {
   };
 
 
+  // grows in place up to Cap, pages are committed as top moves past them. clear and pop_to hand
+  // pages back to the os once more than the decommit slack is committed past top, the slack
+  // keeps an arena that goes up and down every frame from faulting the same pages back in
+  template<size_t Cap, size_t Alignment>
+  class Arena<Cap, Alignment, mem::VirtualAllocPolicy> : private mem::VirtualAllocPolicy<Cap, Alignment> {
+  public:
+    using alloc_t = mem::VirtualAllocPolicy<Cap, Alignment>;
+    Arena() : alloc_t(), top(0) {
+      alloc_t::allocate();
+    }
+    ~Arena() {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* push(size_t size) {
+      u8* result = (u8*)alloc_t::data();
+      const size_t new_top = top + size;
+      if(new_top > Cap || !alloc_t::commit_to(new_top)) {
+        return nullptr;
+      }
+      result += top;
+      top = new_top;
+      return (void*)result;
+    }
+
+    void pop_to(const void* const pos) {
+      const void* const base_ptr = alloc_t::data();
+      if(pos >= (top + (u8*)base_ptr) || pos < base_ptr) {
+        return;
+      }
+      top = PTR2INT(pos) - PTR2INT(base_ptr);
+      trim();
+    }
+
+    void pop_to(size_t pos) {
+      if(pos >= top) {
+        return;
+      }
+      top = pos;
+      trim();
+    }
+
+    void pop_amount(size_t amount) {
+      size_t new_top = top - amount;
+      pop_to(new_top);
+    }
+
+    const void* get_buffer() {
+      return alloc_t::data();
+    }
+
+    const void* get_buffer() const {
+      return alloc_t::data();
+    }
+
+    void clear() {
+      top = 0;
+      trim();
+    }
+
+    const u64 get_size() {
+      return top;
+    }
+
+    const u64 get_size() const {
+      return top;
+    }
+
+    const u64 get_committed() const {
+      return alloc_t::get_committed();
+    }
+
+    // MAX_u64 never decommits
+    void set_decommit_slack(size_t slack) {
+      decommit_slack = slack;
+    }
+
+  private:
+    void trim() {
+      if(decommit_slack != MAX_u64 && alloc_t::get_committed() - top > decommit_slack) {
+        alloc_t::decommit_from(top + decommit_slack);
+      }
+    }
+
+    size_t top = 0;
+    size_t decommit_slack = MAX_u64;
+  };
+
   template<size_t InitialCap = MB(1), size_t Alignment = 8, template<size_t, size_t> class AllocPolicy = mem::SubAllocPolicy>
   class LockFreeArena; 
 
@@ -0,0 +1,614 @@
+// =====================================================================================
+//
+//       Filename:  l_async_file.hpp
+//
+//    Description:  asynchronous file reads, io_uring on linux, blocking io threads elsewhere
+//
+//        Version:  1.0
+//        Created:  2026-10-18 9:14:42 PM
+//       Revision:  none
+//       Compiler:  g++
+//
+//         Author:  Roxi Graves (rg), nada
+//   Organization:  Roxi Psychotronics
+//
+// =====================================================================================
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "l_base.hpp"
+#include "l_vocab.hpp"
+#include "l_sync.hpp"
+
+#if(OS_WINDOWS)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// raw syscalls, no liburing. reads go to the kernel in batches and one reaper thread turns
+// completions into counter bumps
+#ifndef LOFI_IO_URING
+#if(OS_LINUX) && __has_include(<linux/io_uring.h>)
+#define LOFI_IO_URING 1
+#else
+#define LOFI_IO_URING 0
+#endif
+#endif
+
+#if(LOFI_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// submission queue entries, more reads than this in flight wait for the kernel to take some
+#ifndef LOFI_IO_QUEUE_DEPTH
+#define LOFI_IO_QUEUE_DEPTH 256
+#endif
+
+// threads doing blocking reads when io_uring is missing, they never run jobs
+#ifndef LOFI_IO_FALLBACK_THREADS
+#define LOFI_IO_FALLBACK_THREADS 2
+#endif
+
+namespace lofi {
+  namespace io {
+
+#if(OS_WINDOWS)
+    using native_file_t = HANDLE;
+    static const native_file_t InvalidFile = INVALID_HANDLE_VALUE;
+#else
+    using native_file_t = i32;
+    static constexpr native_file_t InvalidFile = -1;
+#endif
+
+    // linux never moves more than this in one read
+    static constexpr u64 MaxReadChunk = 0x7ffff000;
+
+    enum class Backend : u8 {
+      None = 0,
+      Uring,
+      Threads,
+    };
+
+    // one read, owned by the caller until counter has been bumped. the counter is bumped once
+    // per request, so a batch waits for its request count. result is the bytes read, short
+    // only at the end of the file, or -errno
+    struct read_request {
+      read_request* next = nullptr;
+      native_file_t file = InvalidFile;
+      void* buffer = nullptr;
+      u64 size = 0;
+      u64 offset = 0;
+      u64 done = 0;                         // bytes in so far, a short read asks again for the rest
+      i64 result = 0;
+      atomic_counter<>* counter = nullptr;
+    };
+
+    // blocking positional read, what the fallback threads run
+    static i64 read_at(native_file_t file, void* buffer, const u64 size, const u64 offset) {
+      u64 total = 0;
+      while(total < size) {
+        const u64 chunk = MIN(size - total, MaxReadChunk);
+#if(OS_WINDOWS)
+        OVERLAPPED at{};
+        at.Offset = (DWORD)(offset + total);
+        at.OffsetHigh = (DWORD)((offset + total) >> 32);
+        DWORD read = 0;
+        if(!ReadFile(file, (u8*)buffer + total, (DWORD)chunk, &read, &at)) {
+          const DWORD error = GetLastError();
+          if(error == ERROR_HANDLE_EOF) {
+            break;
+          }
+          return -(i64)error;
+        }
+#else
+        const ssize_t read = ::pread(file, (u8*)buffer + total, (size_t)chunk, (off_t)(offset + total));
+        if(read < 0) {
+          if(errno == EINTR) {
+            continue;
+          }
+          return -(i64)errno;
+        }
+#endif
+        if(read == 0) {
+          break;
+        }
+        total += (u64)read;
+      }
+      return (i64)total;
+    }
+
+    class Service {
+    public:
+      static Service* instance() {
+        static Service service;
+        return &service;
+      }
+
+      Service(const Service&) = delete;
+      Service& operator=(const Service&) = delete;
+
+      ~Service() {
+        stop();
+      }
+
+      // io_uring when asked for and the kernel has it, the blocking threads otherwise. nothing
+      // may be in flight when the backend is stopped or switched
+      b8 start(const Backend preferred = Backend::Uring, const u32 queue_depth = LOFI_IO_QUEUE_DEPTH) {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        if(backend != Backend::None) {
+          return true;
+        }
+#if(LOFI_IO_URING)
+        if(preferred == Backend::Uring && start_uring(queue_depth)) {
+          backend = Backend::Uring;
+          return true;
+        }
+#endif
+        start_threads();
+        backend = Backend::Threads;
+        return true;
+      }
+
+      void stop() {
+        std::lock_guard<std::mutex> lock(state_mutex);
+#if(LOFI_IO_URING)
+        if(backend == Backend::Uring) {
+          stop_uring();
+        }
+#endif
+        if(backend == Backend::Threads) {
+          stop_threads();
+        }
+        backend = Backend::None;
+      }
+
+      const Backend get_backend() const {
+        return backend;
+      }
+
+      // the whole batch goes to the kernel in one call, starts the default backend on first use
+      void submit(read_request* requests, const u32 count) {
+        if(backend == Backend::None) {
+          start();
+        }
+        for(u32 i = 0; i < count; i++) {
+          requests[i].next = nullptr;
+          requests[i].done = 0;
+          requests[i].result = 0;
+        }
+#if(LOFI_IO_URING)
+        if(backend == Backend::Uring) {
+          submit_uring(requests, count);
+          return;
+        }
+#endif
+        submit_threads(requests, count);
+      }
+
+      void submit(read_request* request) {
+        submit(request, 1);
+      }
+
+    private:
+      Service() {}
+
+      static void complete(read_request* request, const i64 result) {
+        request->result = result;
+        atomic_counter<>* counter = request->counter;
+        ++(*counter);                       // the request may be gone from here on
+      }
+
+      void start_threads() {
+        stopping = false;
+        for(u32 i = 0; i < LOFI_IO_FALLBACK_THREADS; i++) {
+          fallback_threads[i] = std::thread([this]() {
+            fallback_kernel();
+          });
+        }
+      }
+
+      void stop_threads() {
+        {
+          std::lock_guard<std::mutex> lock(pending_mutex);
+          stopping = true;
+        }
+        pending_signal.notify_all();
+        for(u32 i = 0; i < LOFI_IO_FALLBACK_THREADS; i++) {
+          fallback_threads[i].join();
+        }
+      }
+
+      void submit_threads(read_request* requests, const u32 count) {
+        {
+          std::lock_guard<std::mutex> lock(pending_mutex);
+          for(u32 i = 0; i < count; i++) {
+            if(pending_last) {
+              pending_last->next = &requests[i];
+            } else {
+              pending_first = &requests[i];
+            }
+            pending_last = &requests[i];
+          }
+        }
+        if(count == 1) {
+          pending_signal.notify_one();
+        } else {
+          pending_signal.notify_all();
+        }
+      }
+
+      void fallback_kernel() {
+        for(;;) {
+          read_request* request = nullptr;
+          {
+            std::unique_lock<std::mutex> lock(pending_mutex);
+            pending_signal.wait(lock, [this]() {
+              return pending_first != nullptr || stopping;
+            });
+            if(!pending_first) {
+              return;
+            }
+            request = pending_first;
+            pending_first = request->next;
+            if(!pending_first) {
+              pending_last = nullptr;
+            }
+          }
+          complete(request, read_at(request->file, request->buffer, request->size, request->offset));
+        }
+      }
+
+#if(LOFI_IO_URING)
+      static i32 enter(const i32 fd, const u32 to_submit, const u32 min_complete, const u32 flags) {
+        return (i32)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+      }
+
+      static std::atomic_ref<u32> ring_index(u8* ring, const u32 offset) {
+        return std::atomic_ref<u32>(*(u32*)(ring + offset));
+      }
+
+      b8 start_uring(const u32 queue_depth) {
+        io_uring_params params{};
+        const i32 fd = (i32)syscall(__NR_io_uring_setup, queue_depth, &params);
+        if(fd < 0) {
+          return false;
+        }
+        // IORING_OP_READ came with this feature bit, older kernels get the fallback
+        if(!(params.features & IORING_FEAT_RW_CUR_POS)) {
+          ::close(fd);
+          return false;
+        }
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const b8 single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if(single_mmap) {
+          sq_ring_size = cq_ring_size = MAX(sq_ring_size, cq_ring_size);
+        }
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void* sq = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        void* cq = single_mmap ? sq : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        void* entries = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if(sq == MAP_FAILED || cq == MAP_FAILED || entries == MAP_FAILED) {
+          if(entries != MAP_FAILED) {
+            munmap(entries, sqes_size);
+          }
+          if(cq != MAP_FAILED && cq != sq) {
+            munmap(cq, cq_ring_size);
+          }
+          if(sq != MAP_FAILED) {
+            munmap(sq, sq_ring_size);
+          }
+          ::close(fd);
+          return false;
+        }
+        ring_fd = fd;
+        sq_ring = (u8*)sq;
+        cq_ring = (u8*)cq;
+        sqes = (io_uring_sqe*)entries;
+        sq_off = params.sq_off;
+        cq_off = params.cq_off;
+        sq_entries = params.sq_entries;
+        sq_mask = *(u32*)(sq_ring + sq_off.ring_mask);
+        cq_mask = *(u32*)(cq_ring + cq_off.ring_mask);
+        reaper = std::thread([this]() {
+          reap();
+        });
+        return true;
+      }
+
+      // a nop without a request tells the reaper to leave
+      void stop_uring() {
+        b8 queued = false;
+        for(;;) {
+          {
+            std::lock_guard<std::mutex> lock(sq_mutex);
+            queued = queued || queue_sqe(IORING_OP_NOP, nullptr);
+            if(flush() && queued) {
+              break;
+            }
+          }
+          std::this_thread::yield();
+        }
+        reaper.join();
+        munmap(sqes, sqes_size);
+        if(cq_ring != sq_ring) {
+          munmap(cq_ring, cq_ring_size);
+        }
+        munmap(sq_ring, sq_ring_size);
+        ::close(ring_fd);
+        ring_fd = -1;
+      }
+
+      // sq_mutex held, false while the ring is full
+      b8 queue_sqe(const u8 opcode, read_request* request) {
+        const u32 tail = ring_index(sq_ring, sq_off.tail).load(std::memory_order_relaxed);
+        const u32 head = ring_index(sq_ring, sq_off.head).load(std::memory_order_acquire);
+        if(tail - head >= sq_entries) {
+          return false;
+        }
+        const u32 index = tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(io_uring_sqe));
+        sqe->opcode = opcode;
+        sqe->fd = -1;
+        sqe->user_data = (u64)request;
+        if(request) {
+          sqe->fd = request->file;
+          sqe->off = request->offset + request->done;
+          sqe->addr = (u64)((u8*)request->buffer + request->done);
+          sqe->len = (u32)MIN(request->size - request->done, MaxReadChunk);
+        }
+        ((u32*)(sq_ring + sq_off.array))[index] = index;
+        ring_index(sq_ring, sq_off.tail).store(tail + 1, std::memory_order_release);
+        return true;
+      }
+
+      // sq_mutex held, hands every queued entry to the kernel. false while the kernel is busy,
+      // the caller has to drop sq_mutex before it tries again so the reaper can get in
+      b8 flush() {
+        for(;;) {
+          const u32 tail = ring_index(sq_ring, sq_off.tail).load(std::memory_order_relaxed);
+          const u32 head = ring_index(sq_ring, sq_off.head).load(std::memory_order_acquire);
+          if(tail == head) {
+            return true;
+          }
+          if(enter(ring_fd, tail - head, 0, 0) < 0 && errno != EINTR) {
+            // busy while the completion queue overflows, the reaper drains it
+            L_ASSERT((errno == EAGAIN || errno == EBUSY) && "io_uring_enter failed");
+            return false;
+          }
+        }
+      }
+
+      void submit_uring(read_request* requests, const u32 count) {
+        u32 queued = 0;
+        for(;;) {
+          {
+            std::lock_guard<std::mutex> lock(sq_mutex);
+            while(queued < count && queue_sqe(IORING_OP_READ, &requests[queued])) {
+              queued++;
+            }
+            if(flush() && queued == count) {
+              return;
+            }
+          }
+          std::this_thread::yield();
+        }
+      }
+
+      // never waits on the kernel, whatever does not fit is handed back for the next round
+      read_request* resubmit(read_request* retry) {
+        std::lock_guard<std::mutex> lock(sq_mutex);
+        while(retry) {
+          read_request* next = retry->next;
+          if(!queue_sqe(IORING_OP_READ, retry)) {
+            break;
+          }
+          retry = next;
+        }
+        flush();
+        return retry;
+      }
+
+      // short reads go again only after the completion head is published, a submitter stuck
+      // on a full completion queue is never waiting on the reaper while the reaper waits on it
+      void reap() {
+        read_request* retry = nullptr;
+        b8 leaving = false;
+        for(;;) {
+          u32 head = ring_index(cq_ring, cq_off.head).load(std::memory_order_relaxed);
+          const u32 tail = ring_index(cq_ring, cq_off.tail).load(std::memory_order_acquire);
+          if(head == tail) {
+            if(retry) {
+              retry = resubmit(retry);
+              std::this_thread::yield();
+            } else if(leaving) {
+              return;
+            } else {
+              enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+            }
+            continue;
+          }
+          io_uring_cqe* cqes = (io_uring_cqe*)(cq_ring + cq_off.cqes);
+          while(head != tail) {
+            const io_uring_cqe* cqe = &cqes[head & cq_mask];
+            read_request* request = (read_request*)cqe->user_data;
+            const i32 result = cqe->res;
+            head++;
+            if(!request) {
+              leaving = true;
+              continue;
+            }
+            // a read that stopped short of both the size and the end of the file goes again
+            if(result > 0) {
+              request->done += (u64)result;
+              if(request->done < request->size) {
+                request->next = retry;
+                retry = request;
+                continue;
+              }
+            }
+            complete(request, result < 0 ? (i64)result : (i64)request->done);
+          }
+          ring_index(cq_ring, cq_off.head).store(head, std::memory_order_release);
+          if(retry) {
+            retry = resubmit(retry);
+          }
+        }
+      }
+
+      i32 ring_fd = -1;
+      u8* sq_ring = nullptr;
+      u8* cq_ring = nullptr;
+      io_uring_sqe* sqes = nullptr;
+      size_t sq_ring_size = 0;
+      size_t cq_ring_size = 0;
+      size_t sqes_size = 0;
+      io_sqring_offsets sq_off{};
+      io_cqring_offsets cq_off{};
+      u32 sq_entries = 0;
+      u32 sq_mask = 0;
+      u32 cq_mask = 0;
+      std::mutex sq_mutex;
+      std::thread reaper;
+#endif
+
+      std::atomic<Backend> backend{Backend::None};
+      std::mutex state_mutex;
+
+      read_request* pending_first = nullptr;
+      read_request* pending_last = nullptr;
+      b8 stopping = false;
+      std::mutex pending_mutex;
+      std::condition_variable pending_signal;
+      std::thread fallback_threads[LOFI_IO_FALLBACK_THREADS];
+    };
+
+    static void submit(read_request* requests, const u32 count) {
+      Service::instance()->submit(requests, count);
+    }
+
+  }		// -----  end of namespace io  ----- 
+
+  // read only file whose reads never block a worker. the fiber that asks parks until the
+  // data is in, tasks co_await the request counter instead
+  class AsyncFile {
+  public:
+    AsyncFile() {}
+
+    static AsyncFile open(const char* path) {
+      AsyncFile new_file;
+#if(OS_WINDOWS)
+      new_file.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+#else
+      new_file.file = ::open(path, O_RDONLY | O_CLOEXEC);
+#endif
+      if(!new_file.is_open()) {
+        PRINT("[ERROR]: file at path \"%s\" could not be opened\n", path);
+      }
+      return new_file;
+    }
+
+    AsyncFile(AsyncFile&& other) : file{other.file} {
+      other.file = io::InvalidFile;
+    }
+
+    AsyncFile& operator=(AsyncFile&& other) {
+      if(this != &other) {
+        close();
+        file = other.file;
+        other.file = io::InvalidFile;
+      }
+      return *this;
+    }
+
+    AsyncFile(const AsyncFile&) = delete;
+    AsyncFile& operator=(const AsyncFile&) = delete;
+
+    ~AsyncFile() {
+      close();
+    }
+
+    const b8 is_open() const {
+      return file != io::InvalidFile;
+    }
+
+    // nothing may still be reading from the file
+    b8 close() {
+      if(!is_open()) {
+        return false;
+      }
+#if(OS_WINDOWS)
+      const b8 closed = CloseHandle(file);
+#else
+      const b8 closed = ::close(file) == 0;
+#endif
+      file = io::InvalidFile;
+      return closed;
+    }
+
+    u64 get_size() const {
+#if(OS_WINDOWS)
+      LARGE_INTEGER size{};
+      return GetFileSizeEx(file, &size) ? (u64)size.QuadPart : 0;
+#else
+      struct stat info;
+      return fstat(file, &info) == 0 ? (u64)info.st_size : 0;
+#endif
+    }
+
+    io::native_file_t get_native() const {
+      return file;
+    }
+
+    void prepare_read(io::read_request* request, void* buffer, const u64 size, const u64 offset, atomic_counter<>* counter) const {
+      request->file = file;
+      request->buffer = buffer;
+      request->size = size;
+      request->offset = offset;
+      request->counter = counter;
+    }
+
+    // parks the calling fiber until the read is done, returns the bytes read or -errno
+    template<typename pool_t>
+    i64 read(pool_t* thread_pool, void* buffer, const u64 size, const u64 offset) const {
+      atomic_counter<> done{0};
+      io::read_request request;
+      prepare_read(&request, buffer, size, offset, &done);
+      io::submit(&request, 1);
+      thread_pool->wait_for(&done, 1);
+      return request.result;
+    }
+
+    // requests come with size and offset set, each gets its buffer pushed from arena and the
+    // lot is submitted at once. stops at the first buffer the arena has no room for, returns
+    // how many went out, counter is bumped once for each of them
+    template<typename ArenaT>
+    u32 read_batch(ArenaT* arena, io::read_request* requests, const u32 count, atomic_counter<>* counter) const {
+      u32 ready = 0;
+      for(; ready < count; ready++) {
+        void* buffer = arena->push(requests[ready].size);
+        if(!buffer) {
+          break;
+        }
+        prepare_read(&requests[ready], buffer, requests[ready].size, requests[ready].offset, counter);
+      }
+      if(ready) {
+        io::submit(requests, ready);
+      }
+      return ready;
+    }
+
+  private:
+    io::native_file_t file = io::InvalidFile;
+  };
+
+}		// -----  end of namespace lofi  ----- 
@@ -15,6 +15,7 @@
 // =====================================================================================
 #pragma once
 #include <atomic>
+#include <cstddef>
 #include <emmintrin.h>
 #include "l_vocab.hpp"
 #include "l_sync.hpp"
@@ -33,6 +34,20 @@
 
 #endif
 
+// x86-64 system v switch written in assembly, saves only what the abi asks a callee to keep.
+// the byte code switches below stay the default on windows and on other compilers
+#ifndef LOFI_FIBER_SYSV_ASM
+#if ARCH_X64 && (OS_LINUX || OS_MAC) && (COMPILER_GCC || COMPILER_CLANG)
+#define LOFI_FIBER_SYSV_ASM 1
+#else
+#define LOFI_FIBER_SYSV_ASM 0
+#endif
+#endif
+
+#ifndef LOFI_FIBER_LOCAL_SLOTS
+#define LOFI_FIBER_LOCAL_SLOTS 8
+#endif
+
 namespace lofi {
   namespace fiber {
     DEFINE_FIBER_FUNC(get_context_code) {
@@ -410,19 +425,93 @@ namespace lofi {
       void *rip = nullptr, *rsp = nullptr;
       void *rbx = nullptr, *rbp = nullptr, *r12 = nullptr, *r13 = nullptr, *r14 = nullptr, *r15 = nullptr;
       void *arg = nullptr;
+      u32 mxcsr = 0x1f80;                   // power on defaults, a fresh fiber starts with them
+      u16 fpu_control = 0x037f;
 #else
       void *rip = nullptr, *rsp = nullptr, *arg = nullptr;
 #endif
     };
 
+#if LOFI_FIBER_SYSV_ASM
+    static_assert(offsetof(context, rip) == 0x00 && offsetof(context, rsp) == 0x08 && offsetof(context, rbx) == 0x10
+               && offsetof(context, r15) == 0x38 && offsetof(context, arg) == 0x40 && offsetof(context, mxcsr) == 0x48
+               && offsetof(context, fpu_control) == 0x4c, "context layout does not match the sysv switch");
+
+    // rip is the return address and rsp the stack pointer after returning, so resuming a saved
+    // context is the same as returning from the call that saved it
+#define LOFI_SYSV_SAVE_CONTEXT(from)  \
+      "movq (%rsp), %r8\n\t"          \
+      "movq %r8, 0x00(" from ")\n\t"  \
+      "leaq 0x08(%rsp), %r8\n\t"      \
+      "movq %r8, 0x08(" from ")\n\t"  \
+      "movq %rbx, 0x10(" from ")\n\t" \
+      "movq %rbp, 0x18(" from ")\n\t" \
+      "movq %r12, 0x20(" from ")\n\t" \
+      "movq %r13, 0x28(" from ")\n\t" \
+      "movq %r14, 0x30(" from ")\n\t" \
+      "movq %r15, 0x38(" from ")\n\t" \
+      "stmxcsr 0x48(" from ")\n\t"    \
+      "fnstcw 0x4c(" from ")\n\t"
+
+    // arg goes to rdi for a fresh fiber's entry point, everywhere else rdi is scratch anyway
+#define LOFI_SYSV_LOAD_CONTEXT(to)    \
+      "movq 0x08(" to "), %rsp\n\t"   \
+      "movq 0x10(" to "), %rbx\n\t"   \
+      "movq 0x18(" to "), %rbp\n\t"   \
+      "movq 0x20(" to "), %r12\n\t"   \
+      "movq 0x28(" to "), %r13\n\t"   \
+      "movq 0x30(" to "), %r14\n\t"   \
+      "movq 0x38(" to "), %r15\n\t"   \
+      "movq 0x40(" to "), %rdi\n\t"   \
+      "jmpq *0x00(" to ")\n\t"
+
+    __attribute__((naked, noinline)) inline void get_context_sysv(context* from_context) {
+      asm(LOFI_SYSV_SAVE_CONTEXT("%rdi")
+          "retq\n\t");
+    }
+
+    __attribute__((naked, noinline)) inline void set_context_sysv(context* to_context) {
+      asm("ldmxcsr 0x48(%rdi)\n\t"
+          "fldcw 0x4c(%rdi)\n\t"
+          "movq %rdi, %rsi\n\t"
+          LOFI_SYSV_LOAD_CONTEXT("%rsi"));
+    }
+
+    // ldmxcsr costs tens of ns whenever the value changes, and the sticky exception flags
+    // differ between fibers all the time, so the control words are only loaded when their
+    // control bits differ
+    __attribute__((naked, noinline)) inline void swap_context_sysv(context* from_context, context* to_context) {
+      asm(LOFI_SYSV_SAVE_CONTEXT("%rdi")
+          "movl 0x48(%rdi), %eax\n\t"
+          "xorl 0x48(%rsi), %eax\n\t"
+          "testl $0xffc0, %eax\n\t"
+          "jz 1f\n\t"
+          "ldmxcsr 0x48(%rsi)\n"
+          "1:\n\t"
+          "movzwl 0x4c(%rdi), %eax\n\t"
+          "cmpw 0x4c(%rsi), %ax\n\t"
+          "je 2f\n\t"
+          "fldcw 0x4c(%rsi)\n"
+          "2:\n\t"
+          LOFI_SYSV_LOAD_CONTEXT("%rsi"));
+    }
+
+#undef LOFI_SYSV_SAVE_CONTEXT
+#undef LOFI_SYSV_LOAD_CONTEXT
+#endif
+
 #if OS_WINDOWS
     static void (*get_context)(context*) = (void(*)(context*))get_context_w_code;
+#elif LOFI_FIBER_SYSV_ASM
+    static void (*get_context)(context*) = get_context_sysv;
 #elif (OS_LINUX || OS_MAC)
     static void (*get_context)(context*) = (void(*)(context*))get_context_code;
 #endif
 
 #if OS_WINDOWS
     static void (*set_context)(context*) = (void(*)(context*))set_context_w_code;
+#elif LOFI_FIBER_SYSV_ASM
+    static void (*set_context)(context*) = set_context_sysv;
 #elif (OS_LINUX || OS_MAC)
     static void (*set_context)(context*) = (void(*)(context*))set_context_code;
 #endif
@@ -430,6 +519,8 @@ namespace lofi {
 #if OS_WINDOWS
     static void (*swap_context)(context* from_context, context* to_context) = (void(*)(context*, context*))swap_context_w_code;
     static void (*yield_context)(context* from_context, context* to_context) = (void(*)(context*, context*))yield_context_w_code;
+#elif LOFI_FIBER_SYSV_ASM
+    static void (*swap_context)(context* from_context, context* to_context) = swap_context_sysv;
 #elif (OS_LINUX || OS_MAC)
     static void (*swap_context)(context* from_context, context* to_context) = (void(*)(context*, context*))swap_context_code;
 #endif
@@ -442,18 +533,24 @@ namespace lofi {
       return (void*)temp;
     }
 
-    template<size_t StackSize>
-    static void create_fiber_context(void(*start_func)(void*), void* arg, void* stack, context* context) {
-      u8* temp = (u8*)stack + StackSize;
+    static void create_fiber_context(void(*start_func)(void*), void* arg, void* stack, u64 stack_size, context* context) {
+      u8* temp = (u8*)stack + stack_size;
       temp = (u8*)INT2PTR(ALIGN_POW2_DOWN(PTR2INT(temp), 16));
       temp -= 128;
- 
+#if LOFI_FIBER_SYSV_ASM
+      temp -= 8;                            // entered by a jump, so leave room for the return address a call would have pushed
+#endif
 
       context->rip = (void*)start_func;
       context->rsp = temp;
       context->arg = arg;
     }
 
+    template<size_t StackSize>
+    static void create_fiber_context(void(*start_func)(void*), void* arg, void* stack, context* context) {
+      create_fiber_context(start_func, arg, stack, StackSize, context);
+    }
+
     static void convert_thread_to_fiber(context* _context) {
       get_context(_context);
     }
@@ -463,14 +560,113 @@ namespace lofi {
     }
 
     static void FORCENOINLINE swap_fiber(context* switch_from_fiber, context* switch_to_fiber) {
+#if LOFI_FIBER_SYSV_ASM
+      swap_context_sysv(switch_from_fiber, switch_to_fiber);
+#else
       swap_context(switch_from_fiber, switch_to_fiber);
+#endif
     }
 
+    // only the windows byte code has a separate yield, everywhere else it is a plain swap
     static void FORCENOINLINE yield_fiber(context* switch_from_fiber, context* switch_to_fiber) {
+#if OS_WINDOWS
       yield_context(switch_from_fiber, switch_to_fiber);
+#else
+      swap_fiber(switch_from_fiber, switch_to_fiber);
+#endif
+    }
+
+    struct local_storage {
+      void* slots[LOFI_FIBER_LOCAL_SLOTS] = {};
+
+      void clear() {
+        for(u32 i = 0; i < LOFI_FIBER_LOCAL_SLOTS; i++) {
+          slots[i] = nullptr;
+        }
+      }
+    };
+
+    // storage of the fiber currently running on this thread, the scheduler sets it right
+    // before switching into a fiber and resets it once the fiber switches back out
+    inline thread_local local_storage* current_locals = nullptr;
+    static_assert(LOFI_FIBER_LOCAL_SLOTS <= 64, "fiber local slots are handed out from a 64 bit mask");
+    inline std::atomic<u64> used_local_slots{0};
+
+    // the lowest free slot, LOFI_FIBER_LOCAL_SLOTS when all are in use
+    inline u32 claim_local_slot() {
+      u64 used = used_local_slots.load(std::memory_order_relaxed);
+      u32 slot = 0;
+      while(slot < LOFI_FIBER_LOCAL_SLOTS) {
+        if(used & (1ull << slot)) {
+          slot++;
+          continue;
+        }
+        if(used_local_slots.compare_exchange_weak(used, used | (1ull << slot), std::memory_order_acq_rel, std::memory_order_relaxed)) {
+          return slot;
+        }
+        slot = 0;
+      }
+      return LOFI_FIBER_LOCAL_SLOTS;
+    }
+
+    inline void release_local_slot(u32 slot) {
+      used_local_slots.fetch_and(~(1ull << slot), std::memory_order_acq_rel);
+    }
+
+    // a fiber can resume on another thread, never let the compiler cache the tls address
+    // across a switch
+    inline FORCENOINLINE local_storage* get_current_locals() {
+      return current_locals;
+    }
+
+    inline FORCENOINLINE void set_current_locals(local_storage* locals) {
+      current_locals = locals;
     }
   }		// -----  end of namespace fiber  ----- 
 
+  // typed per fiber slot, every instance claims one of LOFI_FIBER_LOCAL_SLOTS for its lifetime
+  // and gives it back when destroyed. values are cleared when the fiber is returned to the pool,
+  // so they never outlive the job. a slot is only cleared then, so destroy an instance once no
+  // running job has set it. jobs that may not wait run inline on the worker without a fiber of
+  // their own, they always get nullptr and set fails
+  template<typename T>
+  class fiber_local {
+  public:
+    fiber_local() : slot(fiber::claim_local_slot()) {
+      L_ASSERT(slot < LOFI_FIBER_LOCAL_SLOTS && "ran out of fiber local slots");
+    }
+
+    ~fiber_local() {
+      if(slot < LOFI_FIBER_LOCAL_SLOTS) {
+        fiber::release_local_slot(slot);
+      }
+    }
+
+    fiber_local(const fiber_local&) = delete;
+    fiber_local& operator=(const fiber_local&) = delete;
+
+    // nullptr outside of a fiber, in a job that may not wait or when unset
+    T* get() const {
+      fiber::local_storage* locals = fiber::get_current_locals();
+      if(!locals) {
+        return nullptr;
+      }
+      return (T*)locals->slots[slot];
+    }
+
+    b8 set(T* value) const {
+      fiber::local_storage* locals = fiber::get_current_locals();
+      if(!locals) {
+        return false;
+      }
+      locals->slots[slot] = (void*)value;
+      return true;
+    }
+
+  private:
+    const u32 slot;
+  };
+
 
   template<u64 StackSize>
   struct Fiber;
@@ -481,11 +677,13 @@ namespace lofi {
   template<u64 StackSize>
   class Fiber {
   private:
-    using FiberHandle = FiberHandle<StackSize>;
+    using FiberHandle = lofi::FiberHandle<StackSize>;
     FiberHandle prev = nullptr;
     fiber::context _context;
     void* stack = nullptr;
+    u64 stack_size = StackSize;             // StackSize is the default, stacks of any size work
     std::atomic_flag waiting = ATOMIC_FLAG_INIT;
+    fiber::local_storage locals;
   public:
     Fiber() {
       fiber::get_context(&_context);
@@ -504,6 +702,12 @@ namespace lofi {
       fiber::create_fiber_context<StackSize>(main_func, arg, new_stack, &_context);
     }
 
+    Fiber(void(*main_func)(void*), void* arg, void* new_stack, u64 new_stack_size) {
+      stack = new_stack;
+      stack_size = new_stack_size;
+      fiber::create_fiber_context(main_func, arg, new_stack, new_stack_size, &_context);
+    }
+
     b8 operator==(FiberHandle other) {
       if(other->_context.rsp == nullptr) {
         //PRINT_S("RSP IS NULL... RETURNING FALSE\n");
@@ -517,7 +721,7 @@ namespace lofi {
       void* other_stack_ptr = other->_context.rsp;
 
       //PRINT("CHECKING FIBER EQUALITY... FIBER %llu, OTHER FIBER %llu\n", stack, other_stack_ptr);
-      if(other_stack_ptr <= ((u8*)stack + StackSize) && other_stack_ptr > stack) {
+      if(other_stack_ptr <= ((u8*)stack + stack_size) && other_stack_ptr > stack) {
         //PRINT("FIBER %llu, OWNS FIBER %llu... RETURNING TRUE\n", stack, other_stack_ptr);
         return true;
       }
@@ -565,7 +769,13 @@ namespace lofi {
       prev = nullptr;
       _context = fiber::context{};
       stack = nullptr;
+      stack_size = StackSize;
       waiting.clear(std::memory_order_release);
+      locals.clear();
+    }
+
+    fiber::local_storage* get_locals() {
+      return &locals;
     }
 
     const b8 is_waiting() const {
@@ -972,7 +1182,7 @@ namespace lofi {
 //  //! Abstruction for fiber struct.
 //  template<u64 StackSize>
 //    struct Fiber {
-//      using FiberHandle = FiberHandle<StackSize>;
+//      using FiberHandle = lofi::FiberHandle<StackSize>;
 //      /**< fiber context, this is platform dependent. */
 //      FiberContext     context;
 //      FiberHandle prev;
@@ -0,0 +1,213 @@
+// =====================================================================================
+//
+//       Filename:  l_fiber_stack.hpp
+//
+//    Description:  virtual memory backed fiber stacks with guard pages
+//
+//        Version:  1.0
+//        Created:  2026-10-18 1:47:12 PM
+//       Revision:  none
+//       Compiler:  g++
+//
+//         Author:  Roxi Graves (rg), nada
+//   Organization:  Roxi Psychotronics
+//
+// =====================================================================================
+#pragma once
+#include <atomic>
+#include <thread>
+#include "l_memory.hpp"
+
+#ifndef LOFI_FIBER_STACK_SMALL_SIZE
+#define LOFI_FIBER_STACK_SMALL_SIZE KB(16)
+#endif
+
+#ifndef LOFI_FIBER_STACK_LARGE_SIZE
+#define LOFI_FIBER_STACK_LARGE_SIZE MB(1)
+#endif
+
+namespace lofi {
+
+  // Count stacks of StackSize bytes in one reservation, each slot is laid out [guard page | stack]
+  // so running off the bottom of a stack faults instead of walking into the one below it.
+  // a slot's stack is committed when it is first handed out and its pages only become resident
+  // once touched, guard pages are never committed. trim() decommits free stacks again. Count is
+  // a capacity, init() can reserve fewer
+  template<u64 StackSize, u64 Count>
+  class VirtualStackPool {
+  public:
+    static_assert(Count < MAX_u32);
+
+    VirtualStackPool() {}
+
+    ~VirtualStackPool() {
+      release();
+    }
+
+    VirtualStackPool(const VirtualStackPool&) = delete;
+    VirtualStackPool& operator=(const VirtualStackPool&) = delete;
+
+    // node, when given, is where the stack pages should live once touched
+    b8 init(u32 node = MAX_u32, u64 count = Count) {
+      if(base) {
+        return true;
+      }
+      capacity = MAX(MIN(count, Count), (u64)1);
+      guard_size = mem::vm::page_size();
+      L_ASSERT(StackSize % guard_size == 0 && "fiber stack size must be a multiple of the page size");
+      slot_size = StackSize + guard_size;
+      base = (u8*)mem::vm::reserve(slot_size * capacity);
+      if(!base) {
+        return false;
+      }
+      if(node != MAX_u32) {
+        mem::vm::bind_node(base, slot_size * capacity, node);
+      }
+      for(u64 i = 0; i < capacity; i++) {
+        committed[i] = false;
+        state[i].store(SlotFree, std::memory_order_relaxed);
+        next[i].store(i + 1 < capacity ? (u32)(i + 1) : (u32)Count, std::memory_order_relaxed);
+      }
+      top.store(pack(0, 0), std::memory_order_release);
+      return true;
+    }
+
+    void release() {
+      if(base) {
+        mem::vm::release(base, slot_size * capacity);
+        base = nullptr;
+      }
+    }
+
+    // lowest usable address of a free stack, the stack grows down from get_stack() + StackSize.
+    // nullptr when every stack is taken or the os would not commit a new one
+    void* get_stack() {
+      const u32 index = pop_index();
+      if(index == Count) {
+        return nullptr;
+      }
+      // a trim may be decommitting the slot right now, it only holds it for that one call
+      u8 expected = SlotFree;
+      while(!state[index].compare_exchange_weak(expected, SlotTaken, std::memory_order_acquire, std::memory_order_relaxed)) {
+        expected = SlotFree;
+        std::this_thread::yield();
+      }
+      u8* stack = base + index * slot_size + guard_size;
+      if(!committed[index]) {
+        if(!mem::vm::commit(stack, StackSize)) {
+          state[index].store(SlotFree, std::memory_order_release);
+          push_index(index);
+          return nullptr;
+        }
+        committed[index] = true;
+      }
+      return stack;
+    }
+
+    b8 return_stack(void* stack) {
+      if(!owns(stack)) {
+        return false;
+      }
+      const u32 index = (u32)(((u8*)stack - base) / slot_size);
+      state[index].store(SlotFree, std::memory_order_release);
+      push_index(index);
+      return true;
+    }
+
+    const b8 owns(const void* ptr) const {
+      return base && ptr >= (const void*)base && ptr < (const void*)(base + slot_size * capacity);
+    }
+
+    const u64 get_capacity() const {
+      return capacity;
+    }
+
+    static constexpr u64 get_stack_size() {
+      return StackSize;
+    }
+
+    // decommits every stack that is currently free, it is committed again when handed out.
+    // the free list is left alone, a slot is only claimed while its own pages are decommitted,
+    // so fibers can be created and finished while a trim runs
+    void trim() {
+      for(u64 index = 0; index < capacity; index++) {
+        u8 expected = SlotFree;
+        if(!state[index].compare_exchange_strong(expected, SlotTrimming, std::memory_order_acquire, std::memory_order_relaxed)) {
+          continue;
+        }
+        if(committed[index]) {
+          mem::vm::decommit(base + index * slot_size + guard_size, StackSize);
+          committed[index] = false;
+        }
+        state[index].store(SlotFree, std::memory_order_release);
+      }
+    }
+
+    // stacks that are backed by memory right now, free or not
+    const u64 get_committed_count() {
+      u64 count = 0;
+      for(u64 index = 0; index < capacity; index++) {
+        u8 expected = SlotFree;
+        if(state[index].compare_exchange_strong(expected, SlotTrimming, std::memory_order_acquire, std::memory_order_relaxed)) {
+          count += committed[index];
+          state[index].store(SlotFree, std::memory_order_release);
+        }
+        else if(expected == SlotTaken) {
+          count++;
+        }
+      }
+      return count;
+    }
+
+  private:
+    enum : u8 {
+      SlotFree,
+      SlotTaken,
+      SlotTrimming
+    };
+
+    // free list of slot indices, the upper half of top is a tag against aba
+    static constexpr u64 pack(u32 index, u64 tag) {
+      return (tag << 32) | (u64)index;
+    }
+
+    static constexpr u32 index_of(u64 packed) {
+      return (u32)(packed & MAX_u32);
+    }
+
+    static constexpr u64 tag_of(u64 packed) {
+      return packed >> 32;
+    }
+
+    u32 pop_index() {
+      u64 old_top = top.load(std::memory_order_acquire);
+      while(index_of(old_top) != Count) {
+        const u32 index = index_of(old_top);
+        const u64 new_top = pack(next[index].load(std::memory_order_relaxed), tag_of(old_top) + 1);
+        if(top.compare_exchange_weak(old_top, new_top, std::memory_order_acq_rel, std::memory_order_acquire)) {
+          return index;
+        }
+      }
+      return (u32)Count;
+    }
+
+    void push_index(u32 index) {
+      u64 old_top = top.load(std::memory_order_acquire);
+      u64 new_top = 0;
+      do {
+        next[index].store(index_of(old_top), std::memory_order_relaxed);
+        new_top = pack(index, tag_of(old_top) + 1);
+      } while(!top.compare_exchange_weak(old_top, new_top, std::memory_order_acq_rel, std::memory_order_acquire));
+    }
+
+    u8* base = nullptr;
+    u64 guard_size = 0;
+    u64 slot_size = 0;
+    u64 capacity = Count;
+    std::atomic<u64> top{pack((u32)Count, 0)};
+    std::atomic<u32> next[Count];
+    std::atomic<u8> state[Count];           // who may touch committed for the slot
+    b8 committed[Count];                    // only touched by whoever holds the slot's state
+  };
+
+}		// -----  end of namespace lofi  ----- 
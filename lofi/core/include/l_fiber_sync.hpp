@@ -0,0 +1,142 @@
+// =====================================================================================
+//
+//       Filename:  l_fiber_sync.hpp
+//
+//    Description:  mutex, semaphore and condition variable that park fibers
+//
+//        Version:  1.0
+//        Created:  2026-10-18 5:31:40 PM
+//       Revision:  none
+//       Compiler:  g++
+//
+//         Author:  Roxi Graves (rg), nada
+//   Organization:  Roxi Psychotronics
+//
+// =====================================================================================
+#pragma once
+#include <atomic>
+#include "l_thread_pool.hpp"
+
+// all three hand out tickets and wait on an atomic_counter reaching the ticket, a blocked fiber
+// is parked as a counter waiter and its worker goes on to other jobs. the release that reaches
+// a ticket queues exactly that fiber back, so handover is fifo and nobody spins
+
+namespace lofi {
+
+  template<typename pool_t>
+  class fiber_mutex {
+  public:
+    fiber_mutex() {}
+
+    fiber_mutex(const fiber_mutex&) = delete;
+    fiber_mutex& operator=(const fiber_mutex&) = delete;
+
+    void lock() {
+      const u64 ticket = next_ticket.fetch_add(1, std::memory_order_acq_rel);
+      GET_THREAD_POOL(pool_t)->wait_for(&now_serving, ticket);
+    }
+
+    // only takes a ticket that would be served right away
+    b8 try_lock() {
+      u64 serving = now_serving.get_count();
+      return next_ticket.compare_exchange_strong(serving, serving + 1, std::memory_order_acq_rel);
+    }
+
+    void unlock() {
+      ++now_serving;
+    }
+
+  private:
+    std::atomic<u64> next_ticket{0};
+    atomic_counter<> now_serving{0};
+  };
+
+  // permits counts every permit ever made available, ticket n is served once there are n + 1
+  template<typename pool_t>
+  class fiber_semaphore {
+  public:
+    fiber_semaphore(u64 initial_permits = 0) : permits{initial_permits} {}
+
+    fiber_semaphore(const fiber_semaphore&) = delete;
+    fiber_semaphore& operator=(const fiber_semaphore&) = delete;
+
+    void acquire() {
+      const u64 ticket = next_ticket.fetch_add(1, std::memory_order_acq_rel);
+      GET_THREAD_POOL(pool_t)->wait_for(&permits, ticket + 1);
+    }
+
+    b8 try_acquire() {
+      u64 ticket = next_ticket.load(std::memory_order_acquire);
+      while(permits.get_count() > ticket) {
+        if(next_ticket.compare_exchange_weak(ticket, ticket + 1, std::memory_order_acq_rel)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void release(u64 count = 1) {
+      permits.add(count);
+    }
+
+  private:
+    std::atomic<u64> next_ticket{0};
+    atomic_counter<> permits;
+  };
+
+  // signals only ever count up to the number of tickets handed out, so a notify with nobody
+  // waiting is dropped like it is for std::condition_variable
+  template<typename pool_t>
+  class fiber_condition_variable {
+  public:
+    using mutex_t = fiber_mutex<pool_t>;
+
+    fiber_condition_variable() {}
+
+    fiber_condition_variable(const fiber_condition_variable&) = delete;
+    fiber_condition_variable& operator=(const fiber_condition_variable&) = delete;
+
+    // mutex has to be held, it is held again on return
+    void wait(mutex_t& mutex) {
+      const u64 ticket = next_ticket.fetch_add(1, std::memory_order_acq_rel);
+      mutex.unlock();
+      GET_THREAD_POOL(pool_t)->wait_for(&signals, ticket + 1);
+      mutex.lock();
+    }
+
+    template<typename predicate_t>
+    void wait(mutex_t& mutex, predicate_t predicate) {
+      while(!predicate()) {
+        wait(mutex);
+      }
+    }
+
+    void notify_one() {
+      u64 signalled = granted.load(std::memory_order_acquire);
+      do {
+        if(signalled >= next_ticket.load(std::memory_order_acquire)) {
+          return;
+        }
+      } while(!granted.compare_exchange_weak(signalled, signalled + 1, std::memory_order_acq_rel));
+      signals.add(1);
+    }
+
+    void notify_all() {
+      u64 signalled = granted.load(std::memory_order_acquire);
+      u64 waiting = 0;
+      do {
+        waiting = next_ticket.load(std::memory_order_acquire);
+        if(signalled >= waiting) {
+          return;
+        }
+      } while(!granted.compare_exchange_weak(signalled, waiting, std::memory_order_acq_rel));
+      signals.add(waiting - signalled);
+    }
+
+  private:
+    std::atomic<u64> next_ticket{0};
+    std::atomic<u64> granted{0};              // signals promised, signals catches up to it
+    atomic_counter<> signals{0};
+  };
+
+}		// -----  end of namespace lofi  ----- 
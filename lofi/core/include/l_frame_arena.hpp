@@ -0,0 +1,77 @@
+// =====================================================================================
+//
+//       Filename:  l_frame_arena.hpp
+//
+//    Description:  linear arenas per frame in flight and per thread, reset a frame at a time
+//
+//        Version:  1.0
+//        Created:  2026-10-18 9:41:03 AM
+//       Revision:  none
+//       Compiler:  g++
+//
+//         Author:  Roxi Graves (rg), nada
+//   Organization:  Roxi Psychotronics
+//
+// =====================================================================================
+#pragma once
+#include "l_base.hpp"
+#include "l_vocab.hpp"
+#include "l_arena.hpp"
+
+namespace lofi {
+
+  // every frame in flight has an arena per worker of Pool and one more for the thread outside
+  // the pool that drives the frames, so no two threads ever bump the same arena. frame
+  // lifetime data is never freed on its own, the frame's arenas are reset together
+  template<typename Pool, u64 NumFrames, u64 NumThreads, u64 ArenaSize>
+  class FrameArenas {
+  public:
+    static_assert(NumFrames && !(NumFrames & (NumFrames - 1)), "frame count has to be a power of two");
+    static constexpr u64 NumSlots = NumThreads + 1;
+    using arena_t = Arena<ArenaSize, 64, mem::MAllocPolicy>;
+
+    // the calling worker's slot, threads outside the pool share the last one, so only one of
+    // them may allocate at a time
+    static const u64 get_slot() {
+      auto* worker = Pool::get_worker_context();
+      return worker ? (u64)worker->get_thread_id() : NumThreads;
+    }
+
+    // memory that lives until frame id is reset, nullptr once the caller's arena is full
+    void* allocate(u64 id, const u64 size, const u64 alignment = 8) {
+      id &= NumFrames - 1;
+      arena_t& arena = arenas[id][get_slot()];
+      const u64 top = PTR2INT(arena.get_buffer()) + arena.get_size();
+      const u64 padding = ((top + alignment - 1) & ~(alignment - 1)) - top;
+      u8* result = (u8*)arena.push(padding + size);
+      return result ? result + padding : nullptr;
+    }
+
+    template<typename T>
+    T* allocate(u64 id, const u64 count = 1) {
+      return (T*)allocate(id, sizeof(T) * count, alignof(T));
+    }
+
+    // nothing may still be using anything allocated for the frame
+    void reset(u64 id) {
+      id &= NumFrames - 1;
+      for(u64 i = 0; i < NumSlots; i++) {
+        arenas[id][i].clear();
+      }
+    }
+
+    // bytes handed out for frame id over all slots, padding included
+    const u64 get_size(u64 id) const {
+      id &= NumFrames - 1;
+      u64 size = 0;
+      for(u64 i = 0; i < NumSlots; i++) {
+        size += arenas[id][i].get_size();
+      }
+      return size;
+    }
+
+  private:
+    arena_t arenas[NumFrames][NumSlots];
+  };
+
+}		// -----  end of namespace lofi  ----- 
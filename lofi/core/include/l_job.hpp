@@ -14,8 +14,16 @@
 //
 // =====================================================================================
 #pragma once
+#include <new>
+#include <type_traits>
 #include "l_vocab.hpp"
 #include "l_sync.hpp"
+#include "l_allocator.hpp"
+
+// callables up to this many bytes are stored inside the job itself
+#ifndef LOFI_JOB_INLINE_CAPTURE
+#define LOFI_JOB_INLINE_CAPTURE 48
+#endif
 
 #define DECLARE_JOB(name)         static b8   name(void* param, u64 start, u64 end)
 #define DECLARE_JOB_SUCCESS(name) static void name(void* param, void* counter)           // increments the count
@@ -31,7 +39,31 @@ namespace lofi {
     using entry = b8(*)(void*, u64, u64);
     using success = void(*)(void*, void*);
     using failure = void(*)(void*, u64, u64);
- 
+
+    enum class Priority : u8 {
+      High = 0,
+      Mid,
+      Low,
+      Count
+    };
+
+    static constexpr u8 PriorityCount = (u8)Priority::Count;
+
+    // stack size class of the fiber the job runs on
+    enum class Stack : u8 {
+      Default = 0,
+      Small,
+      Large,
+      Count
+    };
+
+    static constexpr u8 StackCount = (u8)Stack::Count;
+
+    // success handler for jobs that only need their counter bumped
+    static void count_success(void* param, void* counter) {
+      ++(*(atomic_counter<>*)counter);
+    }
+
     struct decl {
       entry entry_point= nullptr;
       success job_success = nullptr;
@@ -59,6 +91,54 @@ namespace lofi {
   private:
     job::decl func_table;
     void* data = nullptr;
+    job::Stack stack = job::Stack::Default;
+    b8 may_wait = true;                     // jobs that never wait can skip the fiber entirely
+    u64 deadline_frame = MAX_u64;           // frame the job has to finish in, late jobs drop to low priority
+    b8 has_capture = false;                 // entry_point gets capture instead of data
+    void (*release_box)(void*) = nullptr;   // set for boxed closures, frees a box that never ran
+    u64 capture[(LOFI_JOB_INLINE_CAPTURE + 7) / 8] = {};
+
+    // callables may take (start, end) or nothing and may return b8 or nothing
+    template<typename closure_t>
+    static b8 call(closure_t* closure, u64 start, u64 end) {
+      if constexpr (std::is_invocable_v<closure_t&, u64, u64>) {
+        if constexpr (std::is_void_v<std::invoke_result_t<closure_t&, u64, u64>>) {
+          (*closure)(start, end);
+          return true;
+        } else {
+          return (b8)(*closure)(start, end);
+        }
+      } else {
+        if constexpr (std::is_void_v<std::invoke_result_t<closure_t&>>) {
+          (*closure)();
+          return true;
+        } else {
+          return (b8)(*closure)();
+        }
+      }
+    }
+
+    template<typename closure_t>
+    static b8 invoke_inline(void* capture, u64 start, u64 end) {
+      return call((closure_t*)capture, start, end);
+    }
+
+    // boxed callables run exactly once, so the box goes back to the pool right after
+    template<typename closure_t>
+    static b8 invoke_boxed(void* capture, u64 start, u64 end) {
+      closure_t* boxed = *(closure_t**)capture;
+      const b8 result = call(boxed, start, end);
+      boxed->~closure_t();
+      LockFreeStaticAllocator::deallocate<0, closure_t>(boxed);
+      return result;
+    }
+
+    template<typename closure_t>
+    static void free_boxed(void* capture) {
+      closure_t* boxed = *(closure_t**)capture;
+      boxed->~closure_t();
+      LockFreeStaticAllocator::deallocate<0, closure_t>(boxed);
+    }
   public:
 
     Job() {};
@@ -73,6 +153,10 @@ namespace lofi {
       return *this;
     }
 
+    void* get_obj() const {
+      return data;
+    }
+
     Job& set_table(job::decl&& declaration) {
       func_table = std::move(declaration);
       return *this;
@@ -108,9 +192,74 @@ namespace lofi {
       return *this;
     }
 
+    const u64 get_start() const {
+      return func_table.start;
+    }
+
+    Job& set_stack(job::Stack new_stack) {
+      stack = new_stack;
+      return *this;
+    }
+
+    const job::Stack get_stack() const {
+      return stack;
+    }
+
+    Job& set_may_wait(b8 waits) {
+      may_wait = waits;
+      return *this;
+    }
+
+    const b8 get_may_wait() const {
+      return may_wait;
+    }
+
+    // jobs are copied bytewise through the queues, so a callable is stored inline only when it
+    // fits, is trivially copyable and needs no more than 8 byte alignment. anything else is
+    // moved into a box from the lock free static allocator, which the one run of the job frees.
+    // a boxed job must not be run twice, so periodic and dependent jobs need inline closures
+    template<typename F>
+    Job& set_closure(F&& f) {
+      using closure_t = std::decay_t<F>;
+      if constexpr (sizeof(closure_t) <= sizeof(capture) && alignof(closure_t) <= alignof(u64) && std::is_trivially_copyable_v<closure_t>) {
+        new((void*)capture) closure_t(FWD(f));
+        func_table.entry_point = &Job::invoke_inline<closure_t>;
+      } else {
+        closure_t* boxed = LockFreeStaticAllocator::allocate<0, closure_t>();
+        L_ASSERT(boxed != nullptr && "ran out of closure boxes");
+        new((void*)boxed) closure_t(FWD(f));
+        MEM_COPY(capture, &boxed, sizeof(boxed));
+        func_table.entry_point = &Job::invoke_boxed<closure_t>;
+        release_box = &Job::free_boxed<closure_t>;
+      }
+      has_capture = true;
+      return *this;
+    }
+
+    const b8 is_boxed() const {
+      return release_box != nullptr;
+    }
+
+    // frees the closure box of a job that is dropped without ever running
+    void discard() {
+      if(release_box) {
+        release_box((void*)capture);
+        release_box = nullptr;
+      }
+    }
+
+    Job& set_deadline_frame(u64 frame) {
+      deadline_frame = frame;
+      return *this;
+    }
+
+    const u64 get_deadline_frame() const {
+      return deadline_frame;
+    }
+
     b8 run() {
       if(func_table.entry_point) {
-        b8 result = func_table.entry_point(data, func_table.start, func_table.end);
+        b8 result = func_table.entry_point(has_capture ? (void*)capture : data, func_table.start, func_table.end);
         if (result && func_table.job_success && func_table.counter) {
           func_table.job_success(data, func_table.counter);
           return true;
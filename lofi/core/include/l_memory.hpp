@@ -25,8 +25,21 @@
 
 #include "l_sync.hpp"
 
+#if(OS_LINUX || OS_MAC || OS_ANDROID)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#if(OS_LINUX)
+#include <sys/syscall.h>
+#endif
+
 #define DEFAULT_ALIGNMENT 64
 
+// VirtualAllocPolicy commits in steps of this many bytes, rounded up to whole pages
+#ifndef LOFI_VM_COMMIT_GRANULE
+#define LOFI_VM_COMMIT_GRANULE KB(64)
+#endif
+
 namespace lofi {
 
   template<size_t Size>
@@ -229,6 +242,86 @@ namespace lofi {
 
     }		// -----  end of namespace helpers  ----- 
 
+    // thin layer over the os virtual memory api, sizes are multiples of page_size()
+    // reserved ranges cost address space only, committed pages get physical memory on first touch
+    namespace vm {
+      static u64 page_size() {
+#if(OS_WINDOWS)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return (u64)info.dwPageSize;
+#else
+        return (u64)sysconf(_SC_PAGESIZE);
+#endif
+      }
+
+      static void* reserve(u64 size) {
+#if(OS_WINDOWS)
+        return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+        void* result = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return result == MAP_FAILED ? nullptr : result;
+#endif
+      }
+
+      static b8 commit(void* ptr, u64 size) {
+#if(OS_WINDOWS)
+        return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+        return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+      }
+
+      // hands the physical pages back and makes the range inaccessible again
+      static b8 decommit(void* ptr, u64 size) {
+#if(OS_WINDOWS)
+        return VirtualFree(ptr, size, MEM_DECOMMIT) != 0;
+#else
+        madvise(ptr, size, MADV_DONTNEED);
+        return mprotect(ptr, size, PROT_NONE) == 0;
+#endif
+      }
+
+      // hands the physical pages back but keeps the range usable, contents are lost
+      static b8 discard(void* ptr, u64 size) {
+#if(OS_WINDOWS)
+        return VirtualAlloc(ptr, size, MEM_RESET, PAGE_READWRITE) != nullptr;
+#else
+        return madvise(ptr, size, MADV_DONTNEED) == 0;
+#endif
+      }
+
+      // any access faults, used for guard pages
+      static b8 protect_none(void* ptr, u64 size) {
+#if(OS_WINDOWS)
+        DWORD old_protect = 0;
+        return VirtualProtect(ptr, size, PAGE_NOACCESS, &old_protect) != 0;
+#else
+        return mprotect(ptr, size, PROT_NONE) == 0;
+#endif
+      }
+
+      // prefers numa node for pages of a range that have not been touched yet, call it
+      // between reserve and first use. no-op where the os or libc offers no way to do it
+      static b8 bind_node(void* ptr, u64 size, u32 node) {
+#if(OS_LINUX) && defined(SYS_mbind)
+        constexpr int MPolPreferred = 1;
+        u64 node_mask = 1ull << (node & 63);
+        return syscall(SYS_mbind, ptr, size, MPolPreferred, &node_mask, 64, 0) == 0;
+#else
+        return false;
+#endif
+      }
+
+      static void release(void* ptr, u64 size) {
+#if(OS_WINDOWS)
+        VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+        munmap(ptr, size);
+#endif
+      }
+    }		// -----  end of namespace vm  ----- 
+
 //    static b8 allocate_thread_storage(size_t num_threads, size_t size) {
 //      if(helpers::allocate_tls(num_threads, size))
 //        return true;
@@ -295,6 +388,31 @@ namespace lofi {
       void* data_ptr = nullptr;
     };
 
+    // reserves N bytes of address space and nothing else, pages are committed as the owner asks
+    // for them, so N can be far bigger than what is ever touched and the block never moves
+    template<size_t N, size_t Align = 64>
+    class VirtualAllocPolicy {
+    public:
+      using index_t = u64;
+      ~VirtualAllocPolicy();
+      static constexpr size_t get_size();
+      void* allocate();
+      void deallocate();
+      void* data() const;
+      bool belongs(void* ptr);
+      // makes sure the first size bytes are backed, commits a granule at a time
+      b8 commit_to(size_t size);
+      // hands back every whole page past size
+      b8 decommit_from(size_t size);
+      size_t get_committed() const;
+    private:
+      static_assert(Align <= KB(4), "reserved ranges are only page aligned");
+      void* data_ptr = nullptr;
+      size_t committed = 0;
+      size_t page = 0;
+      static constexpr size_t reserve_size();
+    };
+
     template<size_t N, size_t Align>
     MAllocPolicy<N, Align>::~MAllocPolicy(){
       deallocate();
@@ -356,6 +474,7 @@ namespace lofi {
       L_ASSERT(ptr_diff < 256);
       if(!ptr_diff) {
         align_ptr += Align;
+        ptr_diff = Align;                   // the byte before has to point back past the whole step
       }
       u8* new_ptr = align_ptr - 1;
       *new_ptr = (u8)ptr_diff;
@@ -460,6 +579,89 @@ namespace lofi {
         return true;
       return false;
     }
+
+    template<size_t N, size_t Align>
+    VirtualAllocPolicy<N, Align>::~VirtualAllocPolicy() {
+      deallocate();
+    }
+
+    template<size_t N, size_t Align>
+    constexpr size_t VirtualAllocPolicy<N, Align>::reserve_size() {
+      return (N + LOFI_VM_COMMIT_GRANULE - 1) & ~((size_t)LOFI_VM_COMMIT_GRANULE - 1);
+    }
+
+    template<size_t N, size_t Align>
+    void* VirtualAllocPolicy<N, Align>::allocate() {
+      if(!data_ptr) {
+        page = vm::page_size();
+        data_ptr = vm::reserve(reserve_size());
+        committed = 0;
+      }
+      return data_ptr;
+    }
+
+    template<size_t N, size_t Align>
+    void VirtualAllocPolicy<N, Align>::deallocate() {
+      if(data_ptr) {
+        vm::release(data_ptr, reserve_size());
+      }
+      data_ptr = nullptr;
+      committed = 0;
+    }
+
+    template<size_t N, size_t Align>
+    constexpr size_t VirtualAllocPolicy<N, Align>::get_size() {
+      return N;
+    }
+
+    template<size_t N, size_t Align>
+    void* VirtualAllocPolicy<N, Align>::data() const {
+      return data_ptr;
+    }
+
+    template<size_t N, size_t Align>
+    bool VirtualAllocPolicy<N, Align>::belongs(void* ptr) {
+      if(!data_ptr)
+        return false;
+      if(ptr >= data() && ptr < (uint8_t*)data() + N)
+        return true;
+      return false;
+    }
+
+    template<size_t N, size_t Align>
+    b8 VirtualAllocPolicy<N, Align>::commit_to(size_t size) {
+      if(size <= committed) {
+        return true;
+      }
+      if(!data_ptr || size > N) {
+        return false;
+      }
+      const size_t granule = MAX((size_t)LOFI_VM_COMMIT_GRANULE, page);
+      const size_t new_committed = MIN((size + granule - 1) / granule * granule, reserve_size());
+      if(!vm::commit((u8*)data_ptr + committed, new_committed - committed)) {
+        return false;
+      }
+      committed = new_committed;
+      return true;
+    }
+
+    template<size_t N, size_t Align>
+    b8 VirtualAllocPolicy<N, Align>::decommit_from(size_t size) {
+      const size_t keep = (size + page - 1) / page * page;
+      if(!data_ptr || keep >= committed) {
+        return true;
+      }
+      if(!vm::decommit((u8*)data_ptr + keep, committed - keep)) {
+        return false;
+      }
+      committed = keep;
+      return true;
+    }
+
+    template<size_t N, size_t Align>
+    size_t VirtualAllocPolicy<N, Align>::get_committed() const {
+      return committed;
+    }
   }
 
 }
@@ -17,6 +17,7 @@
 
 #include <atomic>
 #include <thread>
+#include <type_traits>
 #include "l_base.hpp"
 #include "l_vocab.hpp"
 
@@ -44,70 +45,203 @@ namespace lofi {
     std::atomic_flag _flag = ATOMIC_FLAG_INIT;
   };
 
+  // intrusive node for anything that wants to hear when an atomic_counter reaches target
+  // the counter never owns it, it has to stay alive until wake has been called
+  struct counter_waiter {
+    counter_waiter* next = nullptr;
+    u64 target = 0;
+    void (*wake)(counter_waiter*) = nullptr;
+    void* data = nullptr;
+  };
+
   template<u64 Max = MAX_u64>
   class atomic_counter {
   public:
     using count_t = meta::choose_index_type_t<Max>;
 
     atomic_counter() {};
-    atomic_counter(count_t initial_count) : count{initial_count} {};
+    atomic_counter(count_t initial_count) : value{(u64)initial_count} {};
 
     void operator=(count_t new_count) {
-      return count.store(new_count, std::memory_order_release);
+      update([new_count](u64 word) { return (word & WaitersBit) | (u64)new_count; });
     }
 
     void reset() {
-      count.store(0, std::memory_order_release);
+      value.fetch_and(WaitersBit, std::memory_order_release);
     }
 
     count_t clear() {
-      auto current = count.load();
-      while(!count.compare_exchange_weak(current, 0, std::memory_order_acq_rel)) {
-      }
-      return current;
+      return (count_t)(value.fetch_and(WaitersBit, std::memory_order_acq_rel) & CountMask);
     }
 
     const count_t get_count() const {
-      return count.load(std::memory_order_acquire);
+      return (count_t)(value.load(std::memory_order_acquire) & CountMask);
+    }
+
+    // true once the count is at least target and no increment is still inside the counter,
+    // a waiter that saw its target here may destroy the counter right away. anything that
+    // polls a counter it or its caller will free has to check it this way
+    const b8 reached(const u64 target) const {
+      if(get_count() < target) {
+        return false;
+      }
+      while(waiter_lock.test(std::memory_order_acquire)) {}
+      return true;
     }
 
     bool operator==(count_t c) {
-      return count == c;
+      return get_count() == c;
     }
 
     count_t operator++() {
-      count_t val = count.fetch_add(1);
-      return val;
+      return (count_t)update([](u64 word) { return word + 1; });
     }
 
     count_t operator--() {
-      count_t val = count.fetch_sub(1);
-      return val;
+      return (count_t)take(1);
     }
 
 
     count_t operator++(int) {
-      count_t cur = 1 + count.fetch_add(1);
-      return cur;
+      return (count_t)(1 + update([](u64 word) { return word + 1; }));
     }
 
     count_t operator--(int) {
-      count_t cur = count.fetch_sub(1) - 1;
-      return cur;
+      return (count_t)(take(1) - 1);
     }
 
     count_t add(count_t amount) {
-      count_t cur = count.fetch_add(amount);
-      return cur + amount;
+      return (count_t)(update([amount](u64 word) { return word + amount; }) + amount);
     }
 
     count_t sub(count_t amount) {
-      count_t cur = count.fetch_sub(amount);
-      return cur - amount;
+      return (count_t)(take(amount) - amount);
+    }
+
+    // returns false without registering when the count has already reached the target
+    b8 add_waiter(counter_waiter* waiter) {
+      lock_waiters();
+      waiter->next = waiters;
+      waiters = waiter;
+      // from here on every increment goes through the lock and sees this waiter
+      const u64 word = value.fetch_or(WaitersBit, std::memory_order_seq_cst);
+      if((word & CountMask) >= waiter->target) {
+        waiters = waiter->next;
+        if(!waiters) {
+          value.fetch_and(~WaitersBit, std::memory_order_relaxed);
+        }
+        unlock_waiters();
+        return false;
+      }
+      unlock_waiters();
+      return true;
+    }
+
+    // false when the waiter is not registered, it has then been or is about to be woken
+    b8 remove_waiter(counter_waiter* waiter) {
+      lock_waiters();
+      counter_waiter* previous = nullptr;
+      counter_waiter* it = waiters;
+      while(it && it != waiter) {
+        previous = it;
+        it = it->next;
+      }
+      if(it) {
+        if(previous) {
+          previous->next = it->next;
+        } else {
+          waiters = it->next;
+        }
+        if(!waiters) {
+          value.fetch_and(~WaitersBit, std::memory_order_relaxed);
+        }
+      }
+      unlock_waiters();
+      return it != nullptr;
+    }
+
+    const b8 has_waiters() const {
+      return (value.load(std::memory_order_acquire) & WaitersBit) != 0;
     }
 
   private:
-    std::atomic<count_t> count{0};
+    // set while any waiter is registered, it lives in the count's own word so an increment
+    // learns whether it has someone to wake in the same atomic step that makes it visible
+    static constexpr u64 WaitersBit = 1ull << 63;
+    static constexpr u64 CountMask = WaitersBit - 1;
+
+    void lock_waiters() {
+      while(waiter_lock.test_and_set(std::memory_order_acquire)) {}
+    }
+
+    void unlock_waiters() {
+      waiter_lock.clear(std::memory_order_release);
+    }
+
+    // takes amount off the count bits only and returns the count from before. a plain
+    // fetch_sub would borrow from the waiters flag once the count went below zero, so the
+    // count stops at zero instead. nothing is woken, waiters only wait for a count to grow
+    u64 take(const u64 amount) {
+      u64 word = value.load(std::memory_order_relaxed);
+      while(true) {
+        const u64 count = word & CountMask;
+        L_ASSERT(count >= amount && "atomic_counter decremented below zero");
+        const u64 next = (word & WaitersBit) | (count - MIN(count, amount));
+        if(value.compare_exchange_weak(word, next, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+          return count;
+        }
+      }
+    }
+
+    // applies op to the word and returns the count from before. without waiters that is a
+    // single cas and the counter is never touched again, which is all a waiter that saw its
+    // target on its own may rely on. with waiters the change, the pick of the waiters it
+    // releases and the unlock all happen before any of them is woken
+    template<typename Op>
+    u64 update(Op op) {
+      u64 word = value.load(std::memory_order_relaxed);
+      while(!(word & WaitersBit)) {
+        if(value.compare_exchange_weak(word, op(word), std::memory_order_acq_rel, std::memory_order_relaxed)) {
+          return word & CountMask;
+        }
+      }
+      lock_waiters();
+      word = value.load(std::memory_order_relaxed);
+      u64 new_word = op(word);
+      while(!value.compare_exchange_weak(word, new_word, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+        new_word = op(word);
+      }
+      const u64 current = new_word & CountMask;
+      counter_waiter* ready = nullptr;
+      counter_waiter* remaining = nullptr;
+      counter_waiter* it = waiters;
+      while(it) {
+        counter_waiter* next = it->next;
+        if(current >= it->target) {
+          it->next = ready;
+          ready = it;
+        } else {
+          it->next = remaining;
+          remaining = it;
+        }
+        it = next;
+      }
+      waiters = remaining;
+      if(!remaining) {
+        value.fetch_and(~WaitersBit, std::memory_order_relaxed);
+      }
+      unlock_waiters();
+      while(ready) {
+        counter_waiter* next = ready->next;         // the waiter may be gone once woken
+        ready->wake(ready);
+        ready = next;
+      }
+      return word & CountMask;
+    }
+
+    std::atomic<u64> value{0};
+    counter_waiter* waiters = nullptr;            // guarded by waiter_lock
+    std::atomic_flag waiter_lock = ATOMIC_FLAG_INIT;
   };
 
   template<size_t Takes>
@@ -248,7 +382,7 @@ namespace lofi {
     u64 count_to_wait = 0;
     bool to_delete = false;
     b8 check() {
-      return counter->get_count() >= count_to_wait;
+      return counter->reached(count_to_wait);
     }
   };
 
@@ -319,7 +453,7 @@ namespace lofi {
       //PRINT_S("before get count\n");
       //PRINT("current counter %llu\n", PTR2INT(counter));
       //auto cur = counter->get_count();
-      if(counter->get_count() >= count_to_wait) {
+      if(counter->reached(count_to_wait)) {
         //PRINT("wait list check succeeded, cur = %llu, count_to_wait = %llu\n", counter->get_count(), count_to_wait);
         return true;
       }
@@ -412,6 +546,20 @@ namespace lofi {
       return return_object((node*)ptr);
     }
 
+    // pushes a chain already linked through each object's first word with a single cas, every
+    // object in it has to come from this pool
+    void return_objects(node* first, node* last) {
+      node* temp = top.load(std::memory_order_acquire);
+      *((node**)last) = temp;
+      while(!top.compare_exchange_weak(temp, first, std::memory_order_release, std::memory_order_acquire)) {
+        *((node**)last) = temp;
+      }
+    }
+
+    void return_objects(void* first, void* last) {
+      return_objects((node*)first, (node*)last);
+    }
+
 
     b8 object_exists(node* ptr) {
       node* begin = top.load();
@@ -481,8 +629,46 @@ namespace lofi {
     std::atomic<node*> top = nullptr;
   };
   
-  template<typename T, size_t NumThreads = 4>
-  class lock_free_queue {
+  // many threads push raw blocks, only the owner takes them and always takes all of them, so
+  // there is no pop to race and no aba. the next pointer is written into the block itself
+  class remote_free_list {
+  public:
+    void push(void* block) {
+      void* old = head.load(std::memory_order_relaxed);
+      do {
+        *((void**)block) = old;
+      } while(!head.compare_exchange_weak(old, block, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // the blocks pushed so far, linked through their first word, most recent first
+    void* take_all() {
+      if(!head.load(std::memory_order_relaxed)) {
+        return nullptr;
+      }
+      return head.exchange(nullptr, std::memory_order_acquire);
+    }
+
+    const b8 is_empty() const {
+      return head.load(std::memory_order_relaxed) == nullptr;
+    }
+
+  private:
+    alignas(64) std::atomic<void*> head{nullptr};
+  };
+
+  // queue policies for lock_free_queue
+  // one spinlock guarded list per thread id, unbounded, nodes are linked in place
+  struct GuardedListPolicy {};
+
+  // vyukov's bounded mpmc ring of node pointers, no locks, push spins while the ring is full
+  template<size_t Capacity>
+  struct BoundedRingPolicy {};
+
+  template<typename T, size_t NumThreads = 4, typename QueuePolicy = GuardedListPolicy>
+  class lock_free_queue;
+
+  template<typename T, size_t NumThreads>
+  class lock_free_queue<T, NumThreads, GuardedListPolicy> {
   public:
     static_assert((NumThreads & (NumThreads - 1)) == 0);
     static constexpr size_t _ArrayMask = NumThreads - 1;
@@ -610,8 +796,29 @@ namespace lofi {
       }
     }
   
+    // a hint only, pushes that race with the check may be missed
+    b8 is_empty() {
+      for(size_t i = 0; i < NumThreads; i++) {
+        if(!thread_local_pools[i].is_empty()) {
+          return false;
+        }
+      }
+      return true;
+    }
+
     b8 pop(size_t thread_id, T* memory) {
-      // returns pointer to the newly
+      node* new_node = nullptr;
+      if(!pop_node(thread_id, &new_node)) {
+        return false;
+      }
+      MEM_COPY(memory, &new_node->data, sizeof(T));
+      new_node->to_delete = true;
+      return true;
+    }
+
+    // hands out the node itself without marking it to_delete, the caller either does that
+    // once it copied the data out or pushes the node somewhere else
+    b8 pop_node(size_t thread_id, node** popped) {
       node* new_node = nullptr;
       for(size_t i = thread_id; i < NumThreads + thread_id; i++) {
         const size_t index = i & _ArrayMask;
@@ -625,12 +832,38 @@ namespace lofi {
           break;
         }
       }
-      if(new_node) {
-        MEM_COPY(memory, &new_node->data, sizeof(T));
-        new_node->to_delete = true;
-        return true;
+      *popped = new_node;
+      return new_node != nullptr;
+    }
+
+    // takes up to max_count nodes off a single list in one grab
+    u32 pop(size_t thread_id, T* memory, const u32 max_count) {
+      node* first_node = nullptr;
+      node* last_node = nullptr;
+      for(size_t i = thread_id; i < NumThreads + thread_id; i++) {
+        const size_t index = i & _ArrayMask;
+        if(thread_local_pools[index].is_empty()) {
+          continue;
+        }
+        if(thread_local_pools[index].grab()) {
+          thread_local_pools[index].pop(&first_node, &last_node, max_count);
+          thread_local_pools[index].give();
+          break;
+        }
       }
-      return false;
+      u32 count = 0;
+      node* current = first_node;
+      while(current) {
+        node* next = current->next;             // read before the node can be recycled
+        const b8 is_last = current == last_node;
+        MEM_COPY(&memory[count++], &current->data, sizeof(T));
+        current->to_delete = true;
+        if(is_last) {
+          break;
+        }
+        current = next;
+      }
+      return count;
     }
   
   private:
@@ -645,6 +878,272 @@ namespace lofi {
     }
   };
 
+  // dmitry vyukov's bounded mpmc queue. every cell carries a sequence number that tells a
+  // producer or consumer at a given position whether the cell is its turn, so both sides only
+  // ever cas their own position counter. nodes are not linked, the ring holds pointers to them
+  // and pop marks them to_delete exactly like the guarded lists do
+  template<typename T, size_t NumThreads, size_t Capacity>
+  class lock_free_queue<T, NumThreads, BoundedRingPolicy<Capacity>> {
+  public:
+    static_assert(Capacity && (Capacity & (Capacity - 1)) == 0);
+    static constexpr size_t _ArrayMask = Capacity - 1;
+    struct node {
+      T data;
+      node* next = nullptr;
+      b8 to_delete = false;
+      node() : next{nullptr}, to_delete{false} {}
+      void clear() {
+        to_delete = false;
+        next = nullptr;
+      }
+    };
+  private:
+    struct cell {
+      std::atomic<u64> sequence{0};
+      node* data = nullptr;
+    };
+  public:
+
+    lock_free_queue() {
+      clear();
+    }
+
+    b8 try_push(const node* new_node) {
+      u64 position = enqueue_pos.load(std::memory_order_relaxed);
+      for(;;) {
+        cell& slot = cells[position & _ArrayMask];
+        const i64 diff = (i64)slot.sequence.load(std::memory_order_acquire) - (i64)position;
+        if(diff == 0) {
+          if(enqueue_pos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+            slot.data = (node*)new_node;
+            slot.sequence.store(position + 1, std::memory_order_release);
+            return true;
+          }
+        } else if(diff < 0) {
+          return false;                             // full
+        } else {
+          position = enqueue_pos.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    // claims count consecutive cells with one cas, then fills them in order. a cell whose
+    // previous consumer is still copying out is waited on, that window is a few instructions
+    b8 try_push(const node* first, const u32 count) {
+      u64 position = enqueue_pos.load(std::memory_order_relaxed);
+      do {
+        if(position + count > dequeue_pos.load(std::memory_order_acquire) + Capacity) {
+          return false;
+        }
+      } while(!enqueue_pos.compare_exchange_weak(position, position + count, std::memory_order_relaxed));
+      node* current = (node*)first;
+      for(u32 i = 0; i < count; i++) {
+        cell& slot = cells[(position + i) & _ArrayMask];
+        while(slot.sequence.load(std::memory_order_acquire) != position + i) {
+          std::this_thread::yield();
+        }
+        node* next = current->next;
+        slot.data = current;
+        slot.sequence.store(position + i + 1, std::memory_order_release);
+        current = next;
+      }
+      return true;
+    }
+
+    void push(size_t thread_id, const node* new_node) {
+      while(!try_push(new_node)) {
+        std::this_thread::yield();
+      }
+    }
+
+    // first to last linked through next, as for the guarded lists
+    void push(size_t thread_id, const node* first, const node* last, const u32 count) {
+      if(count > Capacity) {
+        node* current = (node*)first;
+        for(u32 i = 0; i < count; i++) {
+          node* next = current->next;
+          push(thread_id, current);
+          current = next;
+        }
+        return;
+      }
+      while(!try_push(first, count)) {
+        std::this_thread::yield();
+      }
+    }
+
+    // a hint only, pushes that race with the check may be missed
+    b8 is_empty() {
+      return dequeue_pos.load(std::memory_order_acquire) >= enqueue_pos.load(std::memory_order_acquire);
+    }
+
+    u64 get_size() {
+      const u64 head = dequeue_pos.load(std::memory_order_acquire);
+      const u64 tail = enqueue_pos.load(std::memory_order_acquire);
+      return tail > head ? tail - head : 0;
+    }
+
+    b8 pop(size_t thread_id, T* memory) {
+      node* popped = nullptr;
+      if(!pop_node(thread_id, &popped)) {
+        return false;
+      }
+      MEM_COPY(memory, &popped->data, sizeof(T));
+      popped->to_delete = true;
+      return true;
+    }
+
+    // hands out the node itself without marking it to_delete, as for the guarded lists
+    b8 pop_node(size_t thread_id, node** popped) {
+      u64 position = dequeue_pos.load(std::memory_order_relaxed);
+      for(;;) {
+        cell& slot = cells[position & _ArrayMask];
+        const i64 diff = (i64)slot.sequence.load(std::memory_order_acquire) - (i64)(position + 1);
+        if(diff == 0) {
+          if(dequeue_pos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+            *popped = slot.data;
+            slot.sequence.store(position + Capacity, std::memory_order_release);
+            return true;
+          }
+        } else if(diff < 0) {
+          return false;                             // empty
+        } else {
+          position = dequeue_pos.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    // claims up to max_count published positions with one cas
+    u32 pop(size_t thread_id, T* memory, const u32 max_count) {
+      u64 position = dequeue_pos.load(std::memory_order_relaxed);
+      u64 count = 0;
+      do {
+        const u64 tail = enqueue_pos.load(std::memory_order_acquire);
+        if(tail <= position) {
+          return 0;
+        }
+        count = MIN(tail - position, (u64)max_count);
+      } while(!dequeue_pos.compare_exchange_weak(position, position + count, std::memory_order_relaxed));
+      for(u64 i = 0; i < count; i++) {
+        cell& slot = cells[(position + i) & _ArrayMask];
+        while(slot.sequence.load(std::memory_order_acquire) != position + i + 1) {
+          std::this_thread::yield();
+        }
+        node* popped = slot.data;
+        slot.sequence.store(position + i + Capacity, std::memory_order_release);
+        MEM_COPY(&memory[i], &popped->data, sizeof(T));
+        popped->to_delete = true;
+      }
+      return (u32)count;
+    }
+
+    // not safe against concurrent pushes or pops
+    void clear() {
+      for(size_t i = 0; i < Capacity; i++) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+        cells[i].data = nullptr;
+      }
+      enqueue_pos.store(0, std::memory_order_relaxed);
+      dequeue_pos.store(0, std::memory_order_release);
+    }
+
+    static constexpr size_t get_capacity() {
+      return Capacity;
+    }
+
+  private:
+    alignas(64) std::atomic<u64> enqueue_pos{0};
+    alignas(64) std::atomic<u64> dequeue_pos{0};
+    alignas(64) cell cells[Capacity];
+  };
+
+  // chase-lev work stealing deque, after le, pop, cohen and zappa nardelli's
+  // "correct and efficient work-stealing for weak memory models"
+  // the owning thread pushes and pops at the bottom (lifo), any other thread may steal from the top (fifo)
+  // storage is a fixed ring, so push reports failure instead of growing
+  template<typename T, size_t Capacity>
+  class work_stealing_deque {
+  public:
+    static_assert((Capacity & (Capacity - 1)) == 0);
+    static_assert(std::is_trivially_copyable_v<T>);
+    static constexpr size_t _ArrayMask = Capacity - 1;
+
+    work_stealing_deque() {}
+
+    // owner only
+    b8 push(T value) {
+      const i64 b = bottom.load(std::memory_order_relaxed);
+      const i64 t = top.load(std::memory_order_acquire);
+      if(b - t >= (i64)Capacity) {
+        return false;
+      }
+      buffer[b & _ArrayMask].store(value, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return true;
+    }
+
+    // owner only
+    b8 pop(T* memory) {
+      const i64 b = bottom.load(std::memory_order_relaxed) - 1;
+      bottom.store(b, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      i64 t = top.load(std::memory_order_relaxed);
+      if(t > b) {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+      }
+      T result = buffer[b & _ArrayMask].load(std::memory_order_relaxed);
+      if(t == b) {
+        // last element, race any thieves for it
+        const b8 won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        if(!won) {
+          return false;
+        }
+      }
+      *memory = result;
+      return true;
+    }
+
+    // any thread
+    b8 steal(T* memory) {
+      i64 t = top.load(std::memory_order_acquire);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      const i64 b = bottom.load(std::memory_order_acquire);
+      if(t >= b) {
+        return false;
+      }
+      T result = buffer[t & _ArrayMask].load(std::memory_order_relaxed);
+      if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return false;
+      }
+      *memory = result;
+      return true;
+    }
+
+    const u64 get_size() const {
+      const i64 b = bottom.load(std::memory_order_relaxed);
+      const i64 t = top.load(std::memory_order_relaxed);
+      return b > t ? (u64)(b - t) : 0;
+    }
+
+    const b8 is_empty() const {
+      return get_size() == 0;
+    }
+
+    // owner only, and only while no thieves are running
+    void clear() {
+      top.store(0, std::memory_order_relaxed);
+      bottom.store(0, std::memory_order_release);
+    }
+
+  private:
+    alignas(64) std::atomic<i64> top{0};
+    alignas(64) std::atomic<i64> bottom{0};
+    alignas(64) std::atomic<T> buffer[Capacity];
+  };
+
 //  template<typename T>
 //  class lock_free_queue {
 //  private:
@@ -1175,7 +1674,7 @@ namespace lofi {
       //PRINT("thread %llu in check and pop\n", thread_id);
       if(pop(thread_id, &node_to_check)) {
         //PRINT("thread %llu found node to check\n", thread_id);
-        if(node_to_check->counter->get_count() >= node_to_check->count_to_wait) {
+        if(node_to_check->counter->reached(node_to_check->count_to_wait)) {
           //PRINT("thread %llu check succeeded\n", thread_id);
           MEM_COPY(memory, &node_to_check->data, sizeof(T));
           try_reclaim(thread_id, node_to_check);
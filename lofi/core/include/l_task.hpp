@@ -0,0 +1,391 @@
+// =====================================================================================
+//
+//       Filename:  l_task.hpp
+//
+//    Description:  c++20 coroutine tasks resumed as jobs on the fiber pool
+//
+//        Version:  1.0
+//        Created:  2026-10-18 8:03:57 PM
+//       Revision:  none
+//       Compiler:  g++
+//
+//         Author:  Roxi Graves (rg), nada
+//   Organization:  Roxi Psychotronics
+//
+// =====================================================================================
+#pragma once
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <optional>
+#include "l_allocator.hpp"
+#include "l_thread_pool.hpp"
+
+// lock free pool the coroutine frames come out of, frames that fit no bucket or find their
+// bucket empty go to the heap instead
+#ifndef LOFI_TASK_FRAME_POOL_ID
+#define LOFI_TASK_FRAME_POOL_ID 0
+#endif
+
+// a suspended task keeps only its frame, a few hundred bytes, where a parked fiber keeps a
+// whole stack. tasks are lazy and are resumed as may_wait(false) jobs, so they never need a
+// fiber. co_await works on other tasks, on atomic_counters and on kicked jobs, anything that
+// completes by bumping a counter, like an i/o request, can be awaited through the counter
+
+namespace lofi {
+
+  template<typename T = void>
+  class task;
+
+  namespace coro {
+
+    struct frame_allocator {
+      using allocator_t = LockFreeRuntimeAllocator<LOFI_TASK_FRAME_POOL_ID>;
+      using bucket_info_t = mem::bucket_info<LOFI_TASK_FRAME_POOL_ID>;
+
+      static constexpr u64 largest_block() {
+        constexpr auto sizes = index_array<typename bucket_info_t::apply_block_size_seq::type>;
+        return bucket_info_t::bucket_count ? sizes[bucket_info_t::bucket_count - 1] : 0;
+      }
+
+      static void* allocate(size_t size) {
+        void* frame = size <= largest_block() ? allocator_t::allocate(size) : nullptr;
+        return frame ? frame : ::operator new(size);
+      }
+
+      static void free(void* frame) {
+        if(!allocator_t::free(frame)) {
+          ::operator delete(frame);
+        }
+      }
+    };
+
+    struct promise_base {
+      std::coroutine_handle<> continuation = nullptr;
+
+      static void* operator new(size_t size) {
+        return frame_allocator::allocate(size);
+      }
+
+      static void operator delete(void* frame) {
+        frame_allocator::free(frame);
+      }
+
+      // hands control straight back to whoever awaited the task, no queue in between
+      struct final_awaiter {
+        b8 await_ready() const noexcept {
+          return false;
+        }
+
+        template<typename promise_t>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_t> handle) noexcept {
+          std::coroutine_handle<> next = handle.promise().continuation;
+          return next ? next : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+      };
+
+      std::suspend_always initial_suspend() const noexcept {
+        return {};
+      }
+
+      final_awaiter final_suspend() const noexcept {
+        return {};
+      }
+
+      void unhandled_exception() const noexcept {
+        std::terminate();
+      }
+    };
+
+    template<typename T>
+    struct promise : promise_base {
+      std::optional<T> value;
+
+      task<T> get_return_object() noexcept;
+
+      template<typename U>
+      void return_value(U&& result) {
+        value.emplace(FWD(result));
+      }
+    };
+
+    template<>
+    struct promise<void> : promise_base {
+      task<void> get_return_object() noexcept;
+
+      void return_void() const noexcept {}
+    };
+
+    // owns itself from the start and frees its frame on the way out, only used by spawn
+    struct detached {
+      struct promise_type {
+        static void* operator new(size_t size) {
+          return frame_allocator::allocate(size);
+        }
+
+        static void operator delete(void* frame) {
+          frame_allocator::free(frame);
+        }
+
+        detached get_return_object() const noexcept {
+          return {};
+        }
+
+        std::suspend_never initial_suspend() const noexcept {
+          return {};
+        }
+
+        std::suspend_never final_suspend() const noexcept {
+          return {};
+        }
+
+        void return_void() const noexcept {}
+
+        void unhandled_exception() const noexcept {
+          std::terminate();
+        }
+      };
+    };
+
+    static b8 resume_handle(void* data, u64 start, u64 end) {
+      std::coroutine_handle<>::from_address(data).resume();
+      return true;
+    }
+
+    // queues a suspended coroutine as a job, the node lives in the awaiter and so in the frame,
+    // which stays put until the job has been popped and run
+    template<typename pool_t>
+    struct resumer {
+      typename pool_t::job_node_t node;
+
+      void resume_later(std::coroutine_handle<> handle, job::Priority priority) {
+        node.clear();
+        node.data = Job{};
+        node.data.set_entry_point(&resume_handle);
+        node.data.set_obj(handle.address());
+        node.data.set_may_wait(false);
+        push(priority);
+      }
+
+      void push(job::Priority priority) {
+        auto* worker = pool_t::get_worker_context();
+        GET_THREAD_POOL(pool_t)->push_job(priority, worker ? worker->get_thread_id() : 0, &node);
+      }
+    };
+
+    // co_await resume_on<pool_t>() moves the rest of the coroutine onto a worker
+    template<typename pool_t>
+    struct resume_on_awaiter {
+      job::Priority priority = job::Priority::High;
+      resumer<pool_t> queued;
+
+      b8 await_ready() const noexcept {
+        return false;
+      }
+
+      void await_suspend(std::coroutine_handle<> handle) {
+        queued.resume_later(handle, priority);
+      }
+
+      void await_resume() const noexcept {}
+    };
+
+    template<typename pool_t>
+    struct counter_awaiter {
+      atomic_counter<>* counter = nullptr;
+      u64 target = 0;
+      job::Priority priority = job::Priority::High;
+      counter_waiter waiter;
+      std::coroutine_handle<> handle;
+      resumer<pool_t> queued;
+
+      b8 await_ready() const noexcept {
+        return counter->reached(target);
+      }
+
+      // the wake may resume the coroutine on another worker before this returns, so nothing
+      // here touches the awaiter after add_waiter. await_suspend has to return a real bool
+      bool await_suspend(std::coroutine_handle<> awaiting) {
+        handle = awaiting;
+        waiter.target = target;
+        waiter.wake = &counter_awaiter::wake;
+        waiter.data = (void*)this;
+        return counter->add_waiter(&waiter);
+      }
+
+      void await_resume() const noexcept {}
+
+      static void wake(counter_waiter* waiter) {
+        counter_awaiter* self = (counter_awaiter*)waiter->data;
+        self->queued.resume_later(self->handle, self->priority);
+      }
+    };
+
+    // runs a copy of the job on the pool and continues the coroutine on the same worker right
+    // after it, the job's own counter and callbacks still fire
+    template<typename pool_t>
+    struct job_awaiter {
+      Job job;
+      job::Priority priority = job::Priority::High;
+      b8 result = false;
+      std::coroutine_handle<> handle;
+      resumer<pool_t> queued;
+
+      b8 await_ready() const noexcept {
+        return false;
+      }
+
+      void await_suspend(std::coroutine_handle<> awaiting) {
+        handle = awaiting;
+        queued.node.clear();
+        queued.node.data = Job{};
+        queued.node.data.set_entry_point(&job_awaiter::run);
+        queued.node.data.set_obj((void*)this);
+        queued.node.data.set_stack(job.get_stack());
+        queued.node.data.set_may_wait(job.get_may_wait());
+        queued.push(priority);
+      }
+
+      b8 await_resume() const noexcept {
+        return result;
+      }
+
+      static b8 run(void* data, u64 start, u64 end) {
+        job_awaiter* self = (job_awaiter*)data;
+        if(!self->job.get_obj()) {
+          self->job.set_obj((void*)GET_THREAD_POOL(pool_t));
+        }
+        self->result = self->job.run();
+        self->handle.resume();
+        return true;
+      }
+    };
+
+    template<typename pool_t>
+    static detached run_detached(task<void> body, job::Priority priority, atomic_counter<>* done);
+
+  }		// -----  end of namespace coro  -----
+
+  // lazy, nothing runs until the task is awaited or spawned. move only, destroying a task that
+  // never ran frees its frame
+  template<typename T>
+  class task {
+  public:
+    using promise_type = coro::promise<T>;
+    using handle_t = std::coroutine_handle<promise_type>;
+
+    task() {}
+    explicit task(handle_t new_handle) : handle{new_handle} {}
+
+    task(task&& other) noexcept : handle{other.handle} {
+      other.handle = nullptr;
+    }
+
+    task& operator=(task&& other) noexcept {
+      if(this != &other) {
+        destroy();
+        handle = other.handle;
+        other.handle = nullptr;
+      }
+      return *this;
+    }
+
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    ~task() {
+      destroy();
+    }
+
+    const b8 is_done() const {
+      return !handle || handle.done();
+    }
+
+    // starts the task and suspends the caller until it returns
+    auto operator co_await() noexcept {
+      struct awaiter {
+        handle_t awaited;
+
+        b8 await_ready() const noexcept {
+          return !awaited || awaited.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+          awaited.promise().continuation = awaiting;
+          return awaited;
+        }
+
+        decltype(auto) await_resume() {
+          if constexpr(!std::is_void_v<T>) {
+            return std::move(*awaited.promise().value);
+          }
+        }
+      };
+      return awaiter{handle};
+    }
+
+  private:
+    void destroy() {
+      if(handle) {
+        handle.destroy();
+        handle = nullptr;
+      }
+    }
+
+    handle_t handle = nullptr;
+  };
+
+  namespace coro {
+    template<typename T>
+    task<T> promise<T>::get_return_object() noexcept {
+      return task<T>{std::coroutine_handle<promise<T>>::from_promise(*this)};
+    }
+
+    inline task<void> promise<void>::get_return_object() noexcept {
+      return task<void>{std::coroutine_handle<promise<void>>::from_promise(*this)};
+    }
+
+    template<typename pool_t>
+    static detached run_detached(task<void> body, job::Priority priority, atomic_counter<>* done) {
+      co_await resume_on_awaiter<pool_t>{priority};
+      co_await body;
+      if(done) {
+        ++(*done);
+      }
+    }
+  }		// -----  end of namespace coro  -----
+
+  // continues the coroutine as a job on one of pool_t's workers
+  template<typename pool_t>
+  static coro::resume_on_awaiter<pool_t> resume_on(job::Priority priority = job::Priority::High) {
+    return coro::resume_on_awaiter<pool_t>{priority};
+  }
+
+  // suspends until counter reaches target, the coroutine is queued back at priority
+  template<typename pool_t>
+  static coro::counter_awaiter<pool_t> wait(atomic_counter<>* counter, const u64 target, job::Priority priority = job::Priority::High) {
+    coro::counter_awaiter<pool_t> awaiter;
+    awaiter.counter = counter;
+    awaiter.target = target;
+    awaiter.priority = priority;
+    return awaiter;
+  }
+
+  // kicks job and suspends until it has run, resumes with what Job::run returned
+  template<typename pool_t>
+  static coro::job_awaiter<pool_t> kick(Job job, job::Priority priority = job::Priority::High) {
+    coro::job_awaiter<pool_t> awaiter;
+    awaiter.job = job;
+    awaiter.priority = priority;
+    return awaiter;
+  }
+
+  // runs body on the pool with nobody awaiting it, done is bumped once it has returned
+  template<typename pool_t>
+  static void spawn(task<void> body, job::Priority priority = job::Priority::High, atomic_counter<>* done = nullptr) {
+    coro::run_detached<pool_t>(std::move(body), priority, done);
+  }
+
+}		// -----  end of namespace lofi  -----
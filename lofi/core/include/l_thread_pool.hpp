@@ -19,6 +19,10 @@
 #include "l_arena.hpp"
 #include "l_tuple.hpp"
 #include "l_fiber.hpp"
+#include "l_fiber_stack.hpp"
+#include "l_timer.hpp"
+#include "l_topology.hpp"
+#include "l_trace.hpp"
 #include "l_variant.hpp"
 #include "l_job.hpp"
 #include "inline/preprocessor.hpp"
@@ -28,40 +32,131 @@
 #endif
 
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// idle workers spin with exponential backoff, then yield their time slice, then park
+#ifndef LOFI_IDLE_SPIN_COUNT
+#define LOFI_IDLE_SPIN_COUNT 64
+#endif
+
+#ifndef LOFI_IDLE_YIELD_COUNT
+#define LOFI_IDLE_YIELD_COUNT 16
+#endif
+
+// parked workers wake up on their own after this long, a safety net for lost wakes
+#ifndef LOFI_IDLE_PARK_TIMEOUT_US
+#define LOFI_IDLE_PARK_TIMEOUT_US 2000
+#endif
+
+// pin each worker to the cpu picked for it by the topology, can be changed before run()
+#ifndef LOFI_PIN_WORKERS
+#define LOFI_PIN_WORKERS 0
+#endif
+
+// container policy of the shared job queues, lofi::BoundedRingPolicy<N> swaps the guarded
+// lists for a lock free ring that blocks pushes once N jobs are queued
+#ifndef LOFI_JOB_QUEUE_POLICY
+#define LOFI_JOB_QUEUE_POLICY lofi::GuardedListPolicy
+#endif
+
+// a lower priority level that a worker has passed over this many times is served once ahead
+// of the higher levels, so low priority work can't starve
+#ifndef LOFI_PRIORITY_AGE_LIMIT
+#define LOFI_PRIORITY_AGE_LIMIT 16
+#endif
+
+#ifndef LOFI_MAX_JOB_SUCCESSORS
+#define LOFI_MAX_JOB_SUCCESSORS 8
+#endif
 
 #define GET_NUM_THREADS(desired_number) CLAMP_TOP(desired_number, MAX((std::thread::hardware_concurrency()), 1))
 
 #define GET_THREAD_POOL(pool_t) pool_t::instance()
 #define GET_HOST_WORKER(pool_t) pool_t::instance()->get_host_worker()
 #define GET_HOST_THREAD_ID(pool_t) pool_t::instance()->get_host_worker()->get_thread_id()
+#define GET_THREAD_SLOT(pool_t) pool_t::get_thread_slot()
 
 namespace lofi {
   template<size_t NumThreads, size_t NumFibers>
   static void fiber_main(void* data);
 
+  struct idle_config {
+    u32 spin_count = LOFI_IDLE_SPIN_COUNT;
+    u32 yield_count = LOFI_IDLE_YIELD_COUNT;
+    u32 park_timeout_us = LOFI_IDLE_PARK_TIMEOUT_US;
+  };
+
+  // pool dimensions picked at run(), 0 takes the hardware thread count for workers and the
+  // full capacity for fibers. both are clamped to the ThreadPool template arguments
+  struct pool_config {
+    u32 workers = 0;
+    u32 fibers = 0;
+  };
+
+  struct idle_stats {
+    u64 spin_hits = 0;        // idle periods that found work while spinning or yielding
+    u64 parks = 0;
+    u64 wakes = 0;            // parked workers woken by a push
+    u64 timeouts = 0;         // parked workers that woke on the timeout
+    u64 wake_requests = 0;    // workers asked to wake by pushes
+  };
+
+  // NumThreads and NumFibers are capacities, the counts actually used are chosen when the pool
+  // starts and workers can be added and retired while it runs
   template<size_t NumThreads, size_t NumFibers>
   class ThreadPool {
     static constexpr u64 StackSize = KB(64);
     static constexpr u64 WaitListSize = 64;
     static constexpr u64 JobQueueSize = 64;
     
-    using Fiber = Fiber<StackSize>;
-    using FiberHandle = FiberHandle<StackSize>;
+    using Fiber = lofi::Fiber<StackSize>;
+    using FiberHandle = lofi::FiberHandle<StackSize>;
 
+    struct timed_wait;
     struct wait_node {
+      counter_waiter waiter;
       FiberHandle handle;
       atomic_counter<>* counter = 0;
-      u64 count_to_wait = 0;
+      timed_wait* timed = nullptr;          // set when the wait has a timeout
+      u32 home = MAX_u32;                   // worker a pinned fiber has to resume on
     };
     using fiber_pool_t = lock_free_pool<Fiber, NumFibers>;
-    using stack_t = mem::Block<StackSize>;
-    using stack_pool_t = lock_free_pool<stack_t, NumFibers>;
-    using task_queue_t = lock_free_queue<Job, NumThreads>;
-    using waiting_fiber_list_t = lock_free_queue<wait_node, NumThreads>;
-    using waiting_fiber_list_node_t = typename waiting_fiber_list_t::node;
-    using waiting_fiber_list_node_handle_t = waiting_fiber_list_node_t*;
+    // one pool per job::Stack class, each big enough for every fiber, only touched pages cost memory
+    using small_stack_pool_t = VirtualStackPool<LOFI_FIBER_STACK_SMALL_SIZE, NumFibers>;
+    using default_stack_pool_t = VirtualStackPool<StackSize, NumFibers>;
+    using large_stack_pool_t = VirtualStackPool<LOFI_FIBER_STACK_LARGE_SIZE, NumFibers>;
+    using task_queue_t = lock_free_queue<Job, NumThreads, LOFI_JOB_QUEUE_POLICY>;
+    using job_deque_t = work_stealing_deque<typename task_queue_t::node*, JobQueueSize>;
+    using trace_ring_t = trace::Ring<LOFI_TRACE_CAPACITY>;
+    // shared by every piece of one parallel_for, lives on the calling fiber's stack
+    struct range_state {
+      job::entry body = nullptr;
+      void* param = nullptr;
+      u64 grain = 1;
+      job::Priority priority = job::Priority::High;
+      atomic_counter<> done{0};             // iterations finished
+      std::atomic<b8> failed{false};
+    };
+    using ready_fiber_list_t = lock_free_queue<wait_node, NumThreads>;
+    using ready_fiber_list_node_t = typename ready_fiber_list_t::node;
+    using ready_fiber_list_node_handle_t = ready_fiber_list_node_t*;
+    using timer_wheel_t = timer::Wheel<>;
+    static constexpr u32 WaitPending = 0;
+    static constexpr u32 WaitReached = 1;
+    static constexpr u32 WaitTimedOut = 2;
+    // the counter and a timer race to finish the wait. both of them and the scheduler that
+    // registers the wait hold a reference, whoever drops the last one queues the fiber again
+    struct timed_wait {
+      timer::node timer;
+      std::atomic<u32> result{WaitPending};
+      std::atomic<u32> refs{3};
+    };
     friend void fiber_main<NumThreads, NumFibers>(void* data);
     static ThreadPool _instance;
+  public:
+    class Worker;
+  private:
   public:
 
     static ThreadPool* instance() {
@@ -70,32 +165,166 @@ namespace lofi {
 
     using job_node_t = typename task_queue_t::node;
 
+    // a job in a dependency graph, released by whichever predecessor finishes last, so chains
+    // of jobs never park a fiber. the caller owns the storage until the job has run, it carries
+    // its own queue node and never touches a worker's job_pool
+    struct dependent_job {
+      Job job;
+      job::Priority priority = job::Priority::High;
+      dependent_job* successors[LOFI_MAX_JOB_SUCCESSORS] = {};
+      u32 successor_count = 0;
+      u64 dependency_count = 0;
+      atomic_counter<> finished_dependencies{0};
+      counter_waiter waiter;
+      job_node_t node;
+
+      dependent_job() {}
+      dependent_job(Job new_job, job::Priority new_priority = job::Priority::High) : job{new_job}, priority{new_priority} {}
+
+      // successor runs only after this job has finished
+      void precede(dependent_job* successor) {
+        L_ASSERT(successor_count < LOFI_MAX_JOB_SUCCESSORS && "too many successors on dependent_job");
+        successors[successor_count++] = successor;
+        successor->dependency_count++;
+      }
+
+      // resets the run state, the graph edges stay
+      void reset() {
+        finished_dependencies.reset();
+      }
+    };
+
+    // a job kicked once after a delay or once every period. the caller owns it until
+    // cancel_timed has returned, which for a one shot that already fired just waits out the kick
+    struct timed_job {
+      Job job;
+      job::Priority priority = job::Priority::High;
+      timer::node timer;
+
+      timed_job() {}
+      timed_job(Job new_job, job::Priority new_priority = job::Priority::High) : job{new_job}, priority{new_priority} {}
+    };
+
     ThreadPool() {
-      num_workers = GET_NUM_THREADS(NumThreads);
-      _workers = (Worker**)RuntimeAllocator<0>::allocate(sizeof(Worker*) * num_workers, 8); // NOLINT
-      for(size_t i = 0; i < num_workers; i++) {
-        _workers[i] = StaticAllocator::allocate<0, Worker>();
+      _topology.discover();
+      num_nodes = _topology.get_node_count();
+      _workers = (Worker**)RuntimeAllocator<0>::allocate(sizeof(Worker*) * NumThreads, 8); // NOLINT
+      for(size_t i = 0; i < NumThreads; i++) {
+        _workers[i] = nullptr;
+        worker_storage[i] = nullptr;
       }
       fiber_pool.set_ptr(StaticAllocator::allocate<0, mem::Block<sizeof(Fiber) * NumFibers>>());
-      stack_pool.set_ptr(StaticAllocator::allocate<0, mem::Block<sizeof(stack_t) * NumFibers>>());
+      for(size_t i = 0; i < NumFibers; i++) {
+        fiber_home[i] = MAX_u32;
+      }
+    }
+
+    // only takes effect before run()
+    b8 configure(const pool_config& config) {
+      if(num_workers.load(std::memory_order_acquire)) {
+        return false;
+      }
+      _config = config;
+      return true;
+    }
+
+    const pool_config& get_config() const {
+      return _config;
     }
 
     b8 run() {
-      for(size_t i = 0; i < num_workers; i++) {
+      const u32 workers = _config.workers ? MIN(_config.workers, (u32)NumThreads) : (u32)GET_NUM_THREADS(NumThreads);
+      const u64 fibers = _config.fibers ? MIN((u64)_config.fibers, (u64)NumFibers) : (u64)NumFibers;
+      // with a single node there is nothing to bind to
+      for(u32 node = 0; node < num_nodes; node++) {
+        const u32 bind_to = num_nodes > 1 ? node : MAX_u32;
+        const b8 stacks_reserved = small_stacks[node].init(bind_to, fibers) && default_stacks[node].init(bind_to, fibers) && large_stacks[node].init(bind_to, fibers);
+        L_ASSERT(stacks_reserved && "failed to reserve fiber stacks");
+        if(!stacks_reserved) {
+          return false;
+        }
+      }
+      for(u32 i = 0; i < workers; i++) {
         //PRINT("constructing worker %llu\n", i);
-        new(_workers[i]) Worker(this, i, StaticAllocator::allocate<0, mem::Block<KB(20)>>());
+        if(add_worker() == MAX_u32) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // starts one more worker, returns its id or MAX_u32 once the pool is at capacity
+    u32 add_worker() {
+      std::lock_guard<std::mutex> lock(resize_mutex);
+      const u32 id = num_workers.load(std::memory_order_acquire);
+      if(id >= NumThreads) {
+        return MAX_u32;
+      }
+      // worker objects and their storage are only allocated once a worker is first added
+      if(!_workers[id]) {
+        _workers[id] = StaticAllocator::allocate<0, Worker>();
+        worker_storage[id] = allocate_worker_storage(_topology.get_worker_cpu(id).node);
+      }
+      // a slot is only reused once its last worker has been joined and every job node it
+      // handed out has been consumed, see retire_worker
+      new(_workers[id]) Worker(this, id, worker_storage[id]);
+      num_workers.store(id + 1, std::memory_order_release);
+      worker_epoch.fetch_add(1, std::memory_order_acq_rel);
+      return id;
+    }
+
+    // stops the worker added last once it has run its pinned work and its local deque, and
+    // every job node it allocated has been consumed. blocks until then, so it can not be called
+    // from that worker. the last worker is never retired
+    b8 retire_worker() {
+      std::lock_guard<std::mutex> lock(resize_mutex);
+      const u32 count = num_workers.load(std::memory_order_acquire);
+      if(count <= 1) {
+        return false;
       }
+      Worker* worker = _workers[count - 1];
+      L_ASSERT(get_worker_context() != worker && "a worker can not retire itself");
+      worker->retiring = true;
+      wake_worker(count - 1);
+      worker->join();
+      num_workers.store(count - 1, std::memory_order_release);
+      worker_epoch.fetch_add(1, std::memory_order_acq_rel);
       return true;
     }
 
+    // queued jobs are dropped, they still give back their closure boxes
     b8 kill() {
-      high_priority_job_queue.clear();
-      mid_priority_job_queue.clear();
-      low_priority_job_queue.clear();
+      Job dropped;
+      for(u32 node = 0; node < num_nodes; node++) {
+        for(u8 i = 0; i < job::PriorityCount; i++) {
+          while(job_queues[node][i].pop(0, &dropped)) {
+            dropped.discard();
+          }
+          job_queues[node][i].clear();
+        }
+      }
+      for(size_t i = 0; i < num_workers; i++) {
+        Worker* worker = _workers[i];
+        while(worker->pinned_jobs.pop(0, &dropped)) {
+          dropped.discard();
+        }
+        worker->pinned_jobs.clear();
+        for(u8 priority = 0; priority < job::PriorityCount; priority++) {
+          job_node_t* node = nullptr;
+          while(worker->local_jobs[priority].steal(&node)) {
+            node->data.discard();
+            node->to_delete = true;
+          }
+        }
+      }
       thread_local_task_counter.reset();
-      for(size_t i = 0; i < NumThreads; i++) {
+      for(size_t i = 0; i < num_workers; i++) {
         _workers[i]->halt();
       }
+      {
+        std::lock_guard<std::mutex> lock(park_mutex);
+        park_signal.notify_all();
+      }
       return true;
     }
 
@@ -103,8 +332,10 @@ namespace lofi {
       if(!kill()) {
         return false;
       }
-      for(size_t i = 0; i < NumThreads; i++) {
-        _workers[i]->join();
+      for(size_t i = 0; i < num_workers; i++) {
+        if(_workers[i]->can_join()) {
+          _workers[i]->join();
+        }
       }
       return true;
     }
@@ -113,32 +344,239 @@ namespace lofi {
       reactor_queue.push(thread_id, first, last, count);
     }
 
+    void push_jobs(job::Priority priority, size_t thread_id, job_node_t* first, job_node_t* last, u32 count) {
+      job_queues[pusher_node(thread_id)][(u8)priority].push(thread_id, first, last, count);
+      wake_workers(count);
+    }
+
     void push_high_priority_jobs(size_t thread_id, job_node_t* first, job_node_t* last, u32 count) {
-      high_priority_job_queue.push(thread_id, first, last, count);
+      push_jobs(job::Priority::High, thread_id, first, last, count);
     }
 
     void push_mid_priority_jobs(size_t thread_id, job_node_t* first, job_node_t* last, u32 count) {
-      mid_priority_job_queue.push(thread_id, first, last, count);
+      push_jobs(job::Priority::Mid, thread_id, first, last, count);
     }
 
     void push_low_priority_jobs(size_t thread_id, job_node_t* first, job_node_t* last, u32 count) {
-      low_priority_job_queue.push(thread_id, first, last, count);
+      push_jobs(job::Priority::Low, thread_id, first, last, count);
     }
 
     void push_reactor_job(size_t thread_id, job_node_t* new_node) {
       reactor_queue.push(thread_id, new_node);
     }
 
+    void push_job(job::Priority priority, size_t thread_id, job_node_t* new_node) {
+      job_queues[pusher_node(thread_id)][(u8)priority].push(thread_id, new_node);
+      wake_workers(1);
+    }
+
     void push_high_priority_job(size_t thread_id, job_node_t* new_node) {
-      high_priority_job_queue.push(thread_id, new_node);
+      push_job(job::Priority::High, thread_id, new_node);
     }
 
     void push_mid_priority_job(size_t thread_id, job_node_t* new_node) {
-      mid_priority_job_queue.push(thread_id, new_node);
+      push_job(job::Priority::Mid, thread_id, new_node);
     }
 
     void push_low_priority_job(size_t thread_id, job_node_t* new_node) {
-      low_priority_job_queue.push(thread_id, new_node);
+      push_job(job::Priority::Low, thread_id, new_node);
+    }
+
+    // pinned jobs only ever run on worker_id, nobody else pops or steals them
+    void push_pinned_jobs(size_t worker_id, size_t thread_id, job_node_t* first, job_node_t* last, u32 count) {
+      L_ASSERT(worker_id < num_workers && "pinned job for a worker that does not exist");
+      L_ASSERT(!_workers[worker_id]->retiring && "pinned job for a retiring worker");
+      _workers[worker_id]->pinned_jobs.push(thread_id, first, last, count);
+      wake_worker(worker_id);
+    }
+
+    void push_pinned_job(size_t worker_id, size_t thread_id, job_node_t* new_node) {
+      L_ASSERT(worker_id < num_workers && "pinned job for a worker that does not exist");
+      L_ASSERT(!_workers[worker_id]->retiring && "pinned job for a retiring worker");
+      _workers[worker_id]->pinned_jobs.push(thread_id, new_node);
+      wake_worker(worker_id);
+    }
+
+    const size_t get_num_workers() const {
+      return num_workers.load(std::memory_order_acquire);
+    }
+
+    // fibers that can be alive at once, per stack class
+    const u64 get_num_fibers() const {
+      return default_stacks[0].get_capacity();
+    }
+
+    // gives the resident pages of all currently unused fiber stacks back to the os
+    void trim_stacks() {
+      for(u32 node = 0; node < num_nodes; node++) {
+        small_stacks[node].trim();
+        default_stacks[node].trim();
+        large_stacks[node].trim();
+      }
+    }
+
+    const topology::CpuTopology& get_topology() const {
+      return _topology;
+    }
+
+    // only affects workers started by a later run()
+    void set_pin_workers(b8 pin) {
+      pin_workers = pin;
+    }
+
+    // moves every recorded scheduler event out of the worker rings, safe to call while the
+    // pool runs as long as only one thread drains at a time
+    template<typename sink_t>
+    u64 drain_trace(sink_t& sink) {
+      u64 count = 0;
+      for(size_t i = 0; i < num_workers; i++) {
+        count += _workers[i]->trace.drain(sink, (u32)i);
+      }
+      return count;
+    }
+
+    // drains into a chrome trace event json file
+    b8 write_trace(const char* path) {
+      trace::ChromeWriter writer;
+      if(!writer.open(path)) {
+        return false;
+      }
+      for(size_t i = 0; i < num_workers; i++) {
+        writer.name_worker((u32)i);
+      }
+      drain_trace(writer);
+      writer.close();
+      return true;
+    }
+
+    // events lost because a ring was full between drains
+    u64 get_dropped_trace_events() const {
+      u64 count = 0;
+      for(size_t i = 0; i < num_workers; i++) {
+        count += _workers[i]->trace.get_dropped();
+      }
+      return count;
+    }
+
+    // jobs with a deadline frame older than the current frame are late and run at low priority
+    u64 begin_frame() {
+      return current_frame.fetch_add(1, std::memory_order_acq_rel) + 1;
+    }
+
+    void set_frame(u64 frame) {
+      current_frame.store(frame, std::memory_order_release);
+    }
+
+    const u64 get_frame() const {
+      return current_frame.load(std::memory_order_acquire);
+    }
+
+    // hands a whole graph to the pool, jobs without dependencies are queued right away and the
+    // rest as their predecessors finish. every job in the graph has to be in jobs
+    void submit(dependent_job* jobs, const u32 job_count) {
+      for(u32 i = 0; i < job_count; i++) {
+        L_ASSERT(!jobs[i].job.is_boxed() && "a dependent job can be submitted again, its closure has to be stored inline");
+        kick_after(&jobs[i].finished_dependencies, jobs[i].dependency_count, &jobs[i]);
+      }
+    }
+
+    // continuation, queues the job once counter reaches target instead of waiting on it
+    void kick_after(atomic_counter<>* counter, const u64 target, dependent_job* next) {
+      next->waiter.target = target;
+      next->waiter.wake = &ThreadPool::release_dependent;
+      next->waiter.data = (void*)next;
+      if(!counter->add_waiter(&next->waiter)) {
+        release_dependent(&next->waiter);
+      }
+    }
+
+    // timers are fired from the scheduler loop of whichever worker polls first, no thread
+    // sleeps on them
+    void kick_delayed(timed_job* entry, u64 delay_ns) {
+      schedule_timed(entry, delay_ns, 0);
+    }
+
+    // the first kick comes one period from now unless first_delay_ns says otherwise
+    void kick_periodic(timed_job* entry, u64 period_ns, u64 first_delay_ns = MAX_u64) {
+      L_ASSERT(period_ns && "periodic job without a period");
+      L_ASSERT(!entry->job.is_boxed() && "a periodic job runs more than once, its closure has to be stored inline");
+      schedule_timed(entry, first_delay_ns == MAX_u64 ? period_ns : first_delay_ns, period_ns);
+    }
+
+    // true when the job had not been kicked for the last time yet. either way the entry is
+    // no longer touched once this returns, a kick that is in flight is waited out
+    b8 cancel_timed(timed_job* entry) {
+      const b8 cancelled = timers.cancel(&entry->timer);
+      timers.quiesce(&entry->timer);
+      return cancelled;
+    }
+
+    // fires whatever is due, callbacks run on the polling worker's scheduler stack
+    void poll_timers() {
+      if(timers.is_empty()) [[likely]] {
+        return;
+      }
+      timers.advance(timer::now_ns());
+    }
+
+    const u32 get_pending_timers() const {
+      return timers.get_size();
+    }
+
+    // takes effect the next time a worker goes idle
+    void set_idle_config(const idle_config& config) {
+      _idle_config = config;
+    }
+
+    const idle_config& get_idle_config() const {
+      return _idle_config;
+    }
+
+    idle_stats get_idle_stats() const {
+      idle_stats result;
+      result.spin_hits = spin_hits.get_count();
+      result.parks = parks.get_count();
+      result.wakes = wakes.get_count();
+      result.timeouts = park_timeouts.get_count();
+      result.wake_requests = wake_requests.get_count();
+      return result;
+    }
+
+    void reset_idle_stats() {
+      spin_hits.reset();
+      parks.reset();
+      wakes.reset();
+      park_timeouts.reset();
+      wake_requests.reset();
+    }
+
+    // hands out at most one wake per sleeping worker, pushers call this after publishing work
+    void wake_workers(u32 count) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      const u32 sleeping = sleeping_workers.load(std::memory_order_seq_cst);
+      if(!sleeping) [[likely]] {
+        return;
+      }
+      std::lock_guard<std::mutex> lock(park_mutex);
+      const u32 unsignaled = sleeping > wake_tokens ? sleeping - wake_tokens : 0;
+      const u32 to_wake = MIN(count, unsignaled);
+      wake_tokens += to_wake;
+      wake_requests.add(to_wake);
+      for(u32 i = 0; i < to_wake; i++) {
+        park_signal.notify_one();
+      }
+    }
+
+    // the wake tokens go to whichever worker gets the lock first, so a worker with pinned work
+    // is found by waking everyone parked and letting the rest go back to sleep
+    void wake_worker(size_t worker_id) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(!sleeping_workers.load(std::memory_order_seq_cst)) [[likely]] {
+        return;
+      }
+      std::lock_guard<std::mutex> lock(park_mutex);
+      ++wake_requests;
+      park_signal.notify_all();
     }
 
     b8 reactor_kernel() {
@@ -153,57 +591,435 @@ namespace lofi {
     }
 
   private:
-    FiberHandle pull_fiber(size_t thread_id, waiting_fiber_list_node_handle_t new_wait_node) {
-      FiberHandle result = nullptr;
-      b8 got_fiber = false;
-      if(waiting_fiber_list.pop(thread_id, &(new_wait_node->data))) {
-        got_fiber = true;
-        if(new_wait_node->data.counter->get_count() >= new_wait_node->data.count_to_wait) {
-          result = new_wait_node->data.handle;
-          new_wait_node->to_delete = true;
-          return result;
-        }
-        new_wait_node->to_delete = false;
-        new_wait_node->next = nullptr;
-        waiting_fiber_list.push(thread_id, new_wait_node);
-      }
-      if(!got_fiber) {
-        new_wait_node->to_delete = true;
-      }
-      result = fiber_pool.get_object();
-      new(result) Fiber(fiber_main<NumThreads, NumFibers>, (void*)this, (void*)stack_pool.get_object());
+    // shared queues are per numa node, workers push to their own node and non worker threads
+    // spread over the nodes by thread id
+    u32 pusher_node(size_t thread_id) {
+      Worker* worker = get_worker_context();
+      if(worker) {
+        return worker->cpu.node;
+      }
+      return (u32)(thread_id % num_nodes);
+    }
+
+    // worker storage lives on the worker's numa node, falls back to the static pool
+    void* allocate_worker_storage(u32 node) {
+      const u64 size = KB(20);
+      void* result = mem::vm::reserve(size);
+      if(!result) {
+        return StaticAllocator::allocate<0, mem::Block<KB(20)>>();
+      }
+      if(num_nodes > 1) {
+        mem::vm::bind_node(result, size, node);
+      }
+      mem::vm::commit(result, size);
       return result;
     }
 
+    // workers that are idle right now and would steal a split off range
+    b8 has_thieves() const {
+      return idle_workers.load(std::memory_order_relaxed) > 0;
+    }
+
+    // lazy binary splitting, the range is worked through grain by grain and only halved when
+    // another worker is idle and the last split half has already been taken, so a single
+    // job node covers the whole range when nobody is around to help
+    static b8 run_range(void* data, u64 start, u64 end) {
+      range_state* state = (range_state*)data;
+      ThreadPool* pool = instance();
+      while(start < end) {
+        const u64 remaining = end - start;
+        if(remaining > state->grain && pool->has_thieves()) {
+          Worker* worker = pool->get_host_worker();
+          if(worker->local_jobs[(u8)state->priority].is_empty()) {
+            const u64 middle = start + remaining / 2;
+            Job half;
+            half.set_entry_point(&ThreadPool::run_range);
+            half.set_obj(data);
+            half.set_may_wait(false);
+            half.set_job_start(middle);
+            half.set_job_end(end);
+            worker->kick_job(state->priority, half);
+            end = middle;
+            continue;
+          }
+        }
+        const u64 chunk_end = MIN(start + state->grain, end);
+        if(!state->body(state->param, start, chunk_end)) {
+          state->failed.store(true, std::memory_order_relaxed);
+        }
+        state->done.add(chunk_end - start);
+        start = chunk_end;
+      }
+      return true;
+    }
+
+    // a hint, only used to decide whether a worker may go idle
+    b8 has_work(Worker* worker) {
+      if(worker->has_pinned_work()) {
+        return true;
+      }
+      if(!timers.is_empty() && timers.is_due(timer::now_ns())) {
+        return true;
+      }
+      for(u8 priority = 0; priority < job::PriorityCount; priority++) {
+        for(u32 node = 0; node < num_nodes; node++) {
+          if(!job_queues[node][priority].is_empty()) {
+            return true;
+          }
+        }
+        for(size_t i = 0; i < num_workers; i++) {
+          if(!_workers[i]->local_jobs[priority].is_empty()) {
+            return true;
+          }
+        }
+      }
+      return !ready_fiber_list.is_empty();
+    }
+
+    void park(Worker* worker) {
+      sleeping_workers.fetch_add(1, std::memory_order_seq_cst);
+      // pairs with the fence in wake_workers, either the pusher sees us asleep or we see its work
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(worker->should_halt || worker->retiring || has_work(worker)) {
+        sleeping_workers.fetch_sub(1, std::memory_order_seq_cst);
+        return;
+      }
+      LOFI_TRACE(worker->trace, ParkBegin, 0);
+      std::unique_lock<std::mutex> lock(park_mutex);
+      ++parks;
+      // one parked worker sleeps only until the next timer is due, the rest keep the full timeout
+      u64 timeout_us = _idle_config.park_timeout_us;
+      const b8 watching = !timers.is_empty() && !timer_watcher.exchange(true, std::memory_order_acq_rel);
+      if(watching) {
+        const u64 now = timer::now_ns();
+        const u64 due = timers.get_next_due();
+        timeout_us = due > now ? MIN(timeout_us, (due - now + 999) / 1000) : 0;
+      }
+      const u32 epoch = timer_epoch;
+      park_signal.wait_for(lock, std::chrono::microseconds(timeout_us), [&]() {
+        return wake_tokens > 0 || worker->should_halt || worker->retiring || worker->has_pinned_work() || timer_epoch != epoch;
+      });
+      if(watching) {
+        timer_watcher.store(false, std::memory_order_release);
+      }
+      // pinned work leaves the shared token to another sleeper
+      const b8 pinned = worker->has_pinned_work();
+      const b8 woken = pinned || wake_tokens > 0;
+      if(!pinned && woken) {
+        wake_tokens--;
+      }
+      if(woken) {
+        ++wakes;
+      } else {
+        ++park_timeouts;
+      }
+      LOFI_TRACE(worker->trace, ParkEnd, woken);
+      sleeping_workers.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    FiberHandle pull_ready_fiber(size_t thread_id) {
+      wait_node ready;
+      if(ready_fiber_list.pop(thread_id, &ready)) {
+        return ready.handle;
+      }
+      return nullptr;
+    }
+
+    // stacks come from the worker's own node first
+    FiberHandle create_fiber(job::Stack stack_class, u32 preferred_node) {
+      void* stack = nullptr;
+      u64 stack_size = 0;
+      for(u32 i = 0; i < num_nodes && !stack; i++) {
+        const u32 node = (preferred_node + i) % num_nodes;
+        switch(stack_class) {
+          case job::Stack::Small:
+            stack = small_stacks[node].get_stack();
+            stack_size = small_stack_pool_t::get_stack_size();
+            break;
+          case job::Stack::Large:
+            stack = large_stacks[node].get_stack();
+            stack_size = large_stack_pool_t::get_stack_size();
+            break;
+          default:
+            stack = default_stacks[node].get_stack();
+            stack_size = default_stack_pool_t::get_stack_size();
+            break;
+        }
+      }
+      L_ASSERT(stack != nullptr && "ran out of fiber stacks");
+      FiberHandle result = fiber_pool.get_object();
+      L_ASSERT(result != nullptr && "ran out of fibers");
+      new(result) Fiber(fiber_main<NumThreads, NumFibers>, (void*)this, stack, stack_size);
+      return result;
+    }
+
+    u32& home_of(FiberHandle fiber) {
+      return fiber_home[fiber - fiber_pool.get_ptr()];
+    }
+
+    // called by the scheduler once the waiting fiber has switched out, so a wake can never
+    // resume a fiber whose context is still being saved
+    void register_waiter(ready_fiber_list_node_handle_t node) {
+      node->data.waiter.data = (void*)node;
+      if(node->data.timed) {
+        register_timed_waiter(node);
+        return;
+      }
+      node->data.waiter.wake = &ThreadPool::wake_waiter;
+      if(!node->data.counter->add_waiter(&node->data.waiter)) {
+        push_ready_fiber(node);
+      }
+    }
+
+    static void wake_waiter(counter_waiter* waiter) {
+      instance()->push_ready_fiber((ready_fiber_list_node_handle_t)waiter->data);
+    }
+
+    // the timer goes in first, a timeout that wins before the counter waiter is added takes
+    // the waiter back out here
+    void register_timed_waiter(ready_fiber_list_node_handle_t node) {
+      timed_wait* timed = node->data.timed;
+      node->data.waiter.wake = &ThreadPool::wake_timed_waiter;
+      timed->timer.fire = &ThreadPool::time_out_waiter;
+      timed->timer.data = (void*)node;
+      schedule_timer(&timed->timer);
+      if(!node->data.counter->add_waiter(&node->data.waiter)) {
+        wake_timed_waiter(&node->data.waiter);
+      } else if(timed->result.load(std::memory_order_acquire) == WaitTimedOut) {
+        if(node->data.counter->remove_waiter(&node->data.waiter)) {
+          release_timed_waiter(node);
+        }
+      }
+      release_timed_waiter(node);
+    }
+
+    // the side that settles the wait also drops the reference of the side it cancelled
+    static void wake_timed_waiter(counter_waiter* waiter) {
+      ready_fiber_list_node_handle_t node = (ready_fiber_list_node_handle_t)waiter->data;
+      timed_wait* timed = node->data.timed;
+      u32 expected = WaitPending;
+      if(timed->result.compare_exchange_strong(expected, WaitReached, std::memory_order_acq_rel)) {
+        if(instance()->timers.cancel(&timed->timer)) {
+          release_timed_waiter(node);
+        }
+      }
+      release_timed_waiter(node);
+    }
+
+    static void time_out_waiter(timer::node* timeout) {
+      ready_fiber_list_node_handle_t node = (ready_fiber_list_node_handle_t)timeout->data;
+      timed_wait* timed = node->data.timed;
+      u32 expected = WaitPending;
+      if(timed->result.compare_exchange_strong(expected, WaitTimedOut, std::memory_order_acq_rel)) {
+        if(node->data.counter->remove_waiter(&node->data.waiter)) {
+          release_timed_waiter(node);
+        }
+      }
+      release_timed_waiter(node);
+    }
+
+    static void release_timed_waiter(ready_fiber_list_node_handle_t node) {
+      if(node->data.timed->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        instance()->push_ready_fiber(node);
+      }
+    }
+
+    // parked workers only re-arm their timeout when they wake, so a timer due earlier than
+    // anything before it wakes them
+    void schedule_timer(timer::node* entry) {
+      const u64 due_before = timers.get_next_due();
+      timers.schedule(entry);
+      if(entry->deadline >= due_before) {
+        return;
+      }
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(!sleeping_workers.load(std::memory_order_seq_cst)) {
+        return;
+      }
+      std::lock_guard<std::mutex> lock(park_mutex);
+      timer_epoch++;
+      park_signal.notify_all();
+    }
+
+    void schedule_timed(timed_job* entry, u64 delay_ns, u64 period_ns) {
+      entry->timer.deadline = timer::now_ns() + delay_ns;
+      entry->timer.period = period_ns;
+      entry->timer.fire = &ThreadPool::fire_timed_job;
+      entry->timer.data = (void*)entry;
+      schedule_timer(&entry->timer);
+    }
+
+    static void fire_timed_job(timer::node* entry) {
+      timed_job* timed = (timed_job*)entry->data;
+      instance()->get_host_worker()->kick_job(timed->priority, timed->job);
+    }
+
+    static void release_dependent(counter_waiter* waiter) {
+      dependent_job* dependent = (dependent_job*)waiter->data;
+      dependent->node.clear();
+      dependent->node.data = Job{};
+      dependent->node.data.set_entry_point(&ThreadPool::run_dependent);
+      dependent->node.data.set_obj((void*)dependent);
+      dependent->node.data.set_stack(dependent->job.get_stack());
+      dependent->node.data.set_may_wait(dependent->job.get_may_wait());
+      Worker* worker = get_worker_context();
+      instance()->push_job(dependent->priority, worker ? worker->get_thread_id() : 0, &dependent->node);
+    }
+
+    static b8 run_dependent(void* data, u64 start, u64 end) {
+      dependent_job* dependent = (dependent_job*)data;
+      // copy everything out first, once the job's own counter moves the caller may reuse it
+      dependent_job* successors[LOFI_MAX_JOB_SUCCESSORS];
+      const u32 successor_count = dependent->successor_count;
+      for(u32 i = 0; i < successor_count; i++) {
+        successors[i] = dependent->successors[i];
+      }
+      Job job = dependent->job;
+      if(!job.get_obj()) {
+        job.set_obj((void*)instance());
+      }
+      const b8 result = job.run();
+      for(u32 i = 0; i < successor_count; i++) {
+        successors[i]->finished_dependencies++;
+      }
+      return result;
+    }
+
+    void push_ready_fiber(ready_fiber_list_node_handle_t node) {
+      Worker* worker = get_worker_context();
+      const size_t thread_id = worker ? worker->get_thread_id() : 0;
+      const u32 home = node->data.home;
+      node->clear();
+      if(home != MAX_u32) {
+        _workers[home]->pinned_ready.push(thread_id, node);
+        wake_worker(home);
+        return;
+      }
+      ready_fiber_list.push(thread_id, node);
+      wake_workers(1);
+    }
+
     void return_fiber(size_t thread_id, FiberHandle fiber_to_return) {
-      stack_pool.return_object((stack_t*)fiber_to_return->get_stack_base());
+      void* stack = fiber_to_return->get_stack_base();
+      for(u32 node = 0; node < num_nodes; node++) {
+        if(default_stacks[node].return_stack(stack) || small_stacks[node].return_stack(stack) || large_stacks[node].return_stack(stack)) {
+          break;
+        }
+      }
+      if(home_of(fiber_to_return) != MAX_u32) {
+        home_of(fiber_to_return) = MAX_u32;
+        _workers[thread_id]->homed_fibers--;        // pinned fibers only ever run on their home
+      }
       fiber_to_return->clear();                       // sets stack to nullptr
       fiber_pool.return_object(fiber_to_return);
     }
 
+    // priority levels are drained in order, except that a level the worker has passed over
+    // LOFI_PRIORITY_AGE_LIMIT times gets one turn first. late jobs pulled from above the low
+    // level are pushed again at low priority instead of being run, in the node they came in,
+    // so any number of them can be demoted without taking nodes from the worker's job_pool
     Job pull_job(size_t thread_id) {
-      Job result;
-      high_priority_job_queue.pop(thread_id, &result);
-      if(!result) {
-        mid_priority_job_queue.pop(thread_id, &result);
-        if(!result) {
-          low_priority_job_queue.pop(thread_id, &result);
+      Worker* worker = _workers[thread_id];
+      const u8 low = (u8)job::Priority::Low;
+      for(;;) {
+        job_node_t* popped = nullptr;
+        const u8 priority = select_job(worker, &popped);
+        if(priority == job::PriorityCount) {
+          return Job{};
         }
+        if(priority < low && popped->data.get_deadline_frame() < get_frame()) {
+          popped->clear();
+          push_job(job::Priority::Low, thread_id, popped);
+          continue;
+        }
+        Job result;
+        MEM_COPY(&result, &popped->data, sizeof(Job));
+        popped->to_delete = true;
+        return result;
       }
-      return result;
+    }
+
+    // the node handed back is not marked to_delete yet, see pull_job
+    u8 select_job(Worker* worker, job_node_t** memory) {
+      for(u8 priority = job::PriorityCount - 1; priority > 0; priority--) {
+        if(worker->priority_age[priority] < LOFI_PRIORITY_AGE_LIMIT) {
+          continue;
+        }
+        worker->priority_age[priority] = 0;
+        if(pull_job_at(worker, priority, memory)) {
+          age_priorities(worker, priority);
+          return priority;
+        }
+      }
+      for(u8 priority = 0; priority < job::PriorityCount; priority++) {
+        if(pull_job_at(worker, priority, memory)) {
+          age_priorities(worker, priority);
+          return priority;
+        }
+      }
+      return job::PriorityCount;
+    }
+
+    // every level below the one just served has been passed over once more
+    static void age_priorities(Worker* worker, u8 served) {
+      worker->priority_age[served] = 0;
+      for(u8 priority = served + 1; priority < job::PriorityCount; priority++) {
+        worker->priority_age[priority]++;
+      }
+    }
+
+    // within a level the worker's own deque comes first, then its node's shared queue, then
+    // workers on the same core, cache and node, and only then the other nodes' queues and
+    // remote workers
+    b8 pull_job_at(Worker* worker, u8 priority, job_node_t** memory) {
+      const size_t thread_id = worker->thread_id;
+      const u32 node = worker->cpu.node;
+      if(worker->local_jobs[priority].pop(memory)) {
+        return true;
+      }
+      if(job_queues[node][priority].pop_node(thread_id, memory)) {
+        return true;
+      }
+      if(steal_job(worker, priority, topology::Distance::SameCore, topology::Distance::SameNode, memory)) {
+        return true;
+      }
+      for(u32 i = 1; i < num_nodes; i++) {
+        if(job_queues[(node + i) % num_nodes][priority].pop_node(thread_id, memory)) {
+          return true;
+        }
+      }
+      return steal_job(worker, priority, topology::Distance::Remote, topology::Distance::Remote, memory);
+    }
+
+    // walks the thief's victims tier by tier, starting at a random victim inside each tier
+    b8 steal_job(Worker* thief, u8 priority, topology::Distance nearest, topology::Distance farthest, job_node_t** memory) {
+      for(u8 tier = (u8)nearest; tier <= (u8)farthest; tier++) {
+        const u32 begin = tier ? thief->victim_tier_end[tier - 1] : 0;
+        const u32 count = thief->victim_tier_end[tier] - begin;
+        if(!count) {
+          continue;
+        }
+        const u32 first_victim = (u32)(thief->next_victim() % count);
+        for(u32 i = 0; i < count; i++) {
+          const u16 victim_id = thief->victims[begin + (first_victim + i) % count];
+          if(_workers[victim_id]->local_jobs[priority].steal(memory)) {
+            LOFI_TRACE(thief->trace, Steal, victim_id);
+            return true;
+          }
+        }
+      }
+      return false;
     }
 
   public:
     class Worker {
     private:
+      friend class ThreadPool;
       friend void fiber_main<NumThreads, NumFibers>(void*);
-      static constexpr size_t MaxDeadHandles = 32;
       static constexpr size_t MaxDeadJobs = 64;
-      using fiber_node_t = waiting_fiber_list_node_t;
+      using fiber_node_t = ready_fiber_list_node_t;
       using fiber_node_handle_t = fiber_node_t*;
       using job_node_t = ThreadPool::job_node_t;
-      using fiber_handle_pool_t = mem::FreeListContainerPolicy<fiber_node_t, MaxDeadHandles, 8, mem::SubAllocPolicy>;
-      using dead_fiber_handles_t = mem::PackedArrayContainerPolicy<fiber_node_handle_t, MaxDeadHandles, 8, mem::SubAllocPolicy>;
       using job_handle_pool_t = mem::FreeListContainerPolicy<job_node_t, MaxDeadJobs, 8, mem::SubAllocPolicy>;
       using dead_job_handles_t = mem::PackedArrayContainerPolicy<job_node_t*, MaxDeadJobs, 8, mem::SubAllocPolicy>;
       using tls_t = Arena<KB(20), 8, mem::SubAllocPolicy>;
@@ -212,10 +1028,11 @@ namespace lofi {
         : pool_ptr(pool)
         , _tls{thread_local_storage}
         , thread_id(_thread_id)
-        , handle_pool(_tls.push(sizeof(fiber_node_t)*MaxDeadHandles))
-        , dead_handles(_tls.push(sizeof(fiber_node_handle_t)*MaxDeadHandles))
         , job_pool(_tls.push(sizeof(job_node_t)*MaxDeadJobs))
         , dead_job_handles(_tls.push(sizeof(job_node_t*)*MaxDeadJobs))
+        , steal_seed(0x9E3779B97F4A7C15ull * (_thread_id + 1))
+        , cpu(pool->_topology.get_worker_cpu((u32)_thread_id))
+        , victim_count(build_victims())
         , _thread(&Worker::run_kernel, this) 
       {
         //PRINT("inside thread %llu constructor, tls = %llu\n", thread_id, thread_local_storage);
@@ -241,103 +1058,166 @@ namespace lofi {
         return current_fiber;
       }
 
-      fiber_node_handle_t create_waiter() {
-        auto index = dead_handles.add_object(handle_pool.add_object());
-        L_ASSERT(dead_handles[index] != nullptr && "ran out of waiter nodes in handle_pool");
-        dead_handles[index]->to_delete = false;
-        dead_handles[index]->next = nullptr;
-        dead_handles[index]->data.handle = nullptr;
-        return dead_handles[index];
+      // the wait node lives on the waiting fiber's stack, which stays put until it is resumed
+      // the fiber may come back on another thread, so nothing here touches the worker afterwards
+      void fiber_wait(lofi::atomic_counter<>* counter, const u64 count_to_wait) {
+        if(counter->reached(count_to_wait)) {
+          return;
+        }
+        // a job kicked with set_may_wait(false) has no fiber to park, it holds the worker and
+        // yields until the count is reached
+        if(!current_fiber) {
+          pool_ptr->wait_for(counter, count_to_wait);
+          return;
+        }
+        fiber_node_t wait_handle;
+        wait_handle.data.waiter.target = count_to_wait;
+        wait_handle.data.counter = counter;
+        wait_handle.data.handle = current_fiber;
+        wait_handle.data.home = pool_ptr->home_of(current_fiber);
+        pending_wait = &wait_handle;
+        LOFI_TRACE(trace, Wait, count_to_wait);
+        current_fiber->wait();
+        LOFI_TRACE(get_worker_context()->trace, Resume, 0);
       }
 
-      void fiber_wait(lofi::atomic_counter<>* counter, const u64 count_to_wait) {
-        fiber_node_handle_t wait_handle = create_waiter();
-        wait_handle->to_delete = false;
-        wait_handle->next = nullptr;
-        wait_handle->data.counter = counter;
-        wait_handle->data.count_to_wait = count_to_wait;
-        wait_handle->data.handle = current_fiber;
-        pool_ptr->waiting_fiber_list.push(thread_id, wait_handle);
+      // returns false when timeout_ns ran out first, the timer lives on the fiber's stack
+      b8 fiber_wait(lofi::atomic_counter<>* counter, const u64 count_to_wait, const u64 timeout_ns) {
+        if(counter->reached(count_to_wait)) {
+          return true;
+        }
+        if(!current_fiber) {
+          return pool_ptr->wait_for(counter, count_to_wait, timeout_ns);
+        }
+        timed_wait timed;
+        timed.timer.deadline = timer::now_ns() + timeout_ns;
+        fiber_node_t wait_handle;
+        wait_handle.data.waiter.target = count_to_wait;
+        wait_handle.data.counter = counter;
+        wait_handle.data.handle = current_fiber;
+        wait_handle.data.home = pool_ptr->home_of(current_fiber);
+        wait_handle.data.timed = &timed;
+        pending_wait = &wait_handle;
+        LOFI_TRACE(trace, Wait, count_to_wait);
         current_fiber->wait();
+        LOFI_TRACE(get_worker_context()->trace, Resume, 0);
+        // the timeout may have woken us from inside its own fire, the frame has to outlive it
+        pool_ptr->timers.quiesce(&timed.timer);
+        return timed.result.load(std::memory_order_acquire) == WaitReached;
       }
 
-      void kick_high_priority_jobs(Job* jobs, const u32 job_count) {
-        auto first_index = MAX_u64;
-        auto last_index = MAX_u64;
-        for(u32 i = 0; i < job_count; i++) {
-          auto index = dead_job_handles.add_object(job_pool.add_object());
-          L_ASSERT(dead_job_handles[index] != nullptr && "ran out of job nodes in high priority job_pool");
-          dead_job_handles[index]->data = jobs[i];
-          dead_job_handles[index]->clear();
-          if(last_index != MAX_u64) {
-            dead_job_handles[last_index]->next = dead_job_handles[index];
-          } else {
-            first_index = index;
-          }
-          last_index = index;
+      // kicks a callable as a job, counter is bumped once it returns true. captures that fit
+      // the job are not allocated at all
+      template<typename F>
+      void kick_closure(job::Priority priority, F&& f, atomic_counter<>* counter = nullptr, b8 may_wait = true) {
+        Job job;
+        job.set_closure(FWD(f));
+        job.set_may_wait(may_wait);
+        if(counter) {
+          job.set_job_counter(counter);
+          job.set_job_success(job::count_success);
         }
-        pool_ptr->push_high_priority_jobs(thread_id, dead_job_handles[first_index], dead_job_handles[last_index], job_count);
+        kick_job(priority, job);
       }
 
-      void kick_mid_priority_jobs(Job* jobs, const u32 job_count) {
-        auto first_index = MAX_u64;
-        auto last_index = MAX_u64;
+      // jobs kicked from the worker's own thread land in its local deque where idle workers
+      // can steal them, anything that does not fit overflows into the shared queue
+      void kick_jobs(job::Priority priority, Job* jobs, const u32 job_count) {
+        const b8 is_local = is_host_thread();
+        job_node_t* first = nullptr;
+        job_node_t* last = nullptr;
+        u32 overflow_count = 0;
         for(u32 i = 0; i < job_count; i++) {
-          auto index = dead_job_handles.add_object(job_pool.add_object());
-          L_ASSERT(dead_job_handles[index] != nullptr && "ran out of job nodes in high priority job_pool");
-          dead_job_handles[index]->data = jobs[i];
-          dead_job_handles[index]->clear();
-          if(last_index != MAX_u64) {
-            dead_job_handles[last_index]->next = dead_job_handles[index];
+          job_node_t* node = create_job_node(jobs[i]);
+          if(is_local && local_jobs[(u8)priority].push(node)) {
+            continue;
+          }
+          if(last) {
+            last->next = node;
           } else {
-            first_index = index;
+            first = node;
           }
-          last_index = index;
+          last = node;
+          overflow_count++;
+        }
+        if(overflow_count) {
+          pool_ptr->push_jobs(priority, thread_id, first, last, overflow_count);
+        }
+        if(job_count > overflow_count) {
+          pool_ptr->wake_workers(job_count - overflow_count);
         }
-        pool_ptr->push_mid_priority_jobs(thread_id, dead_job_handles[first_index], dead_job_handles[last_index], job_count);
       }
 
+      // runs the job on worker_id only, checked by that worker before any shared or stealable
+      // queue. if the job waits its fiber is resumed on worker_id again, so per thread state
+      // can be touched without a lock
+      void kick_pinned_job(size_t worker_id, Job job) {
+        pool_ptr->push_pinned_job(worker_id, thread_id, create_job_node(job));
+      }
 
-      void kick_low_priority_jobs(Job* jobs, const u32 job_count) {
-        auto first_index = MAX_u64;
-        auto last_index = MAX_u64;
-        for(u32 i = 0; i < job_count; i++) {
-          auto index = dead_job_handles.add_object(job_pool.add_object());
-          L_ASSERT(dead_job_handles[index] != nullptr && "ran out of job nodes in high priority job_pool");
-          dead_job_handles[index]->data = jobs[i];
-          dead_job_handles[index]->clear();
-          if(last_index != MAX_u64) {
-            dead_job_handles[last_index]->next = dead_job_handles[index];
-          } else {
-            first_index = index;
-          }
-          last_index = index;
+      void kick_pinned_jobs(size_t worker_id, Job* jobs, const u32 job_count) {
+        if(!job_count) {
+          return;
+        }
+        job_node_t* first = create_job_node(jobs[0]);
+        job_node_t* last = first;
+        for(u32 i = 1; i < job_count; i++) {
+          job_node_t* node = create_job_node(jobs[i]);
+          last->next = node;
+          last = node;
         }
-        pool_ptr->push_mid_priority_jobs(thread_id, dead_job_handles[first_index], dead_job_handles[last_index], job_count);
+        pool_ptr->push_pinned_jobs(worker_id, thread_id, first, last, job_count);
+      }
+
+      void kick_job(job::Priority priority, Job job) {
+        job_node_t* node = create_job_node(job);
+        if(is_host_thread() && local_jobs[(u8)priority].push(node)) {
+          pool_ptr->wake_workers(1);
+          return;
+        }
+        pool_ptr->push_job(priority, thread_id, node);
+      }
+
+      // runs body over [begin, end) in grain sized chunks and returns once every chunk is done.
+      // a calling fiber is parked meanwhile and may come back on another worker, any other
+      // caller yields. a grain of 0 picks one from the range and worker count
+      b8 parallel_for(u64 begin, u64 end, u64 grain, job::entry body, void* param, job::Priority priority = job::Priority::High) {
+        if(begin >= end) {
+          return true;
+        }
+        const u64 count = end - begin;
+        range_state state;
+        state.body = body;
+        state.param = param;
+        state.priority = priority;
+        state.grain = grain ? grain : MAX(count / (pool_ptr->num_workers * 8), 1ull);
+        ThreadPool::run_range(&state, begin, end);
+        pool_ptr->wait_for(&state.done, count);
+        return !state.failed.load(std::memory_order_relaxed);
+      }
+
+      void kick_high_priority_jobs(Job* jobs, const u32 job_count) {
+        kick_jobs(job::Priority::High, jobs, job_count);
+      }
+
+      void kick_mid_priority_jobs(Job* jobs, const u32 job_count) {
+        kick_jobs(job::Priority::Mid, jobs, job_count);
+      }
+
+      void kick_low_priority_jobs(Job* jobs, const u32 job_count) {
+        kick_jobs(job::Priority::Low, jobs, job_count);
       }
 
       void kick_high_priority_job(Job job) {
-        auto index = dead_job_handles.add_object(job_pool.add_object());
-        L_ASSERT(dead_job_handles[index] != nullptr && "ran out of job nodes in high priority job_pool");
-        dead_job_handles[index]->data = job;
-        dead_job_handles[index]->clear();
-        pool_ptr->push_high_priority_job(thread_id, dead_job_handles[index]);
+        kick_job(job::Priority::High, job);
       }
 
       void kick_mid_priority_job(Job job) {
-        auto index = dead_job_handles.add_object(job_pool.add_object());
-        L_ASSERT(dead_job_handles[index] != nullptr && "ran out of job nodes in high priority job_pool");
-        dead_job_handles[index]->data = job;
-        dead_job_handles[index]->clear();
-        pool_ptr->push_mid_priority_job(thread_id, dead_job_handles[index]);
+        kick_job(job::Priority::Mid, job);
       }
 
       void kick_low_priority_job(Job job) {
-        auto index = dead_job_handles.add_object(job_pool.add_object());
-        L_ASSERT(dead_job_handles[index] != nullptr && "ran out of job nodes in low priority job_pool");
-        dead_job_handles[index]->data = job;
-        dead_job_handles[index]->clear();
-        pool_ptr->push_low_priority_job(thread_id,dead_job_handles[index]);
+        kick_job(job::Priority::Low, job);
       }
 
       b8 owns(FiberHandle fiber) {
@@ -379,20 +1259,139 @@ namespace lofi {
         current_fiber->yield();
       }
 
-      b8 try_delete_fiber(u32 index) {
-        if(dead_handles[index]->to_delete) {
-          handle_pool.remove_object((void*)dead_handles[index]);
-          dead_handles[index]->to_delete = false;
-          dead_handles.remove_object(index);
-          return true;
+      b8 is_host_thread() const {
+        return get_worker_context() == this;
+      }
+
+      job_node_t* create_job_node(const Job& job) {
+        auto index = dead_job_handles.add_object(job_pool.add_object());
+        L_ASSERT(dead_job_handles[index] != nullptr && "ran out of job nodes in job_pool");
+        job_node_t* node = dead_job_handles[index];
+        node->data = job;
+        node->clear();
+        return node;
+      }
+
+      // owner only
+      b8 pop_local_job(u8 priority, Job* memory) {
+        job_node_t* node = nullptr;
+        if(!local_jobs[priority].pop(&node)) {
+          return false;
+        }
+        MEM_COPY(memory, &node->data, sizeof(Job));
+        node->to_delete = true;
+        return true;
+      }
+
+      b8 has_pinned_work() {
+        return !pinned_jobs.is_empty() || !pinned_ready.is_empty();
+      }
+
+      FiberHandle pull_pinned_fiber() {
+        wait_node ready;
+        if(pinned_ready.pop(thread_id, &ready)) {
+          return ready.handle;
+        }
+        return nullptr;
+      }
+
+      void idle() {
+        pool_ptr->idle_workers.fetch_add(1, std::memory_order_relaxed);
+        idle_inner();
+        pool_ptr->idle_workers.fetch_sub(1, std::memory_order_relaxed);
+      }
+
+      void idle_inner() {
+        const idle_config config = pool_ptr->get_idle_config();
+        for(u32 i = 0; i < config.spin_count; i++) {
+          const u32 pauses = 1u << MIN(i, 6u);
+          for(u32 j = 0; j < pauses; j++) {
+            _mm_pause();
+          }
+          if(should_halt || pool_ptr->has_work(this)) {
+            ++pool_ptr->spin_hits;
+            return;
+          }
+        }
+        for(u32 i = 0; i < config.yield_count; i++) {
+          std::this_thread::yield();
+          if(should_halt || pool_ptr->has_work(this)) {
+            ++pool_ptr->spin_hits;
+            return;
+          }
+        }
+        pool_ptr->park(this);
+      }
+
+      // jobs kicked with set_may_wait(false) run right here on the scheduler stack, no fiber,
+      // no stack and no context switch
+      void run_inline(Job& job) {
+        if(!job.get_obj()) {
+          job.set_obj((void*)pool_ptr);
+        }
+        Job to_run = job;
+        job = Job{};
+        LOFI_TRACE(trace, JobBegin, to_run.get_start());
+        to_run.run();
+        LOFI_TRACE(trace, JobEnd, to_run.get_start());
+      }
+
+      // every other worker, sorted into distance tiers from this worker's cpu
+      u32 build_victims() {
+        u32 count = 0;
+        for(u8 tier = 0; tier < topology::DistanceCount; tier++) {
+          for(size_t i = 0; i < pool_ptr->num_workers; i++) {
+            if(i == thread_id) {
+              continue;
+            }
+            const topology::cpu& other = pool_ptr->_topology.get_worker_cpu((u32)i);
+            if((u8)topology::distance(cpu, other) == tier) {
+              victims[count++] = (u16)i;
+            }
+          }
+          victim_tier_end[tier] = count;
+        }
+        return count;
+      }
+
+      // xorshift, only used to spread thieves across victims
+      u64 next_victim() {
+        steal_seed ^= steal_seed << 13;
+        steal_seed ^= steal_seed >> 7;
+        steal_seed ^= steal_seed << 17;
+        return steal_seed;
+      }
+
+      // picks up workers added or retired since the victims were last built
+      void refresh_victims() {
+        const u32 epoch = pool_ptr->worker_epoch.load(std::memory_order_acquire);
+        if(epoch != victim_epoch) {
+          victim_epoch = epoch;
+          victim_count = build_victims();
+        }
+      }
+
+      b8 pop_any_local_job(Job* memory) {
+        for(u8 priority = 0; priority < job::PriorityCount; priority++) {
+          if(pop_local_job(priority, memory)) {
+            return true;
+          }
         }
         return false;
       }
 
-      void prune_dead_fiber_handles() {
-        for(size_t i = 0; i < dead_handles.get_size(); i++) {
-          try_delete_fiber(i);
+      b8 has_local_work() {
+        for(u8 priority = 0; priority < job::PriorityCount; priority++) {
+          if(!local_jobs[priority].is_empty()) {
+            return true;
+          }
         }
+        return has_pinned_work();
+      }
+
+      // a retiring worker only leaves once nothing can reach it any more
+      b8 is_drained() {
+        return !has_local_work() && !homed_fibers && !dead_job_handles.get_size();
       }
 
       void prune_dead_job_handles() {
@@ -406,13 +1405,12 @@ namespace lofi {
       }
 
       void run_kernel() {
+        host_worker = this;
+        if(pool_ptr->pin_workers) {
+          topology::pin_current_thread(cpu.id);
+        }
 
         //PRINT("thread %llu running kernel\n", thread_id);
-#if(OS_WINDOWS)
-        //SetThreadAffinityMask((HANDLE)_thread.native_handle(), BIT(thread_id));
-#elif (OS_LINUX)
-#elif (OS_MAC)
-#endif
         //const size_t num_tasks = pool_ptr->get_num_init_tasks();
         //execute_initialization_tasks();
         //while(pool_ptr->get_current_thread_local_task_count() <= num_tasks) {
@@ -420,19 +1418,69 @@ namespace lofi {
         //    std::this_thread::sleep_for(5ms);
         //}
         while(!should_halt) {
-          if(current_fiber) [[likely]] {
-            //using namespace std::chrono_literals;
-            //std::this_thread::sleep_for(5ms);
-            prune_dead_job_handles();
-            if(!current_fiber->is_waiting()) {
-              pool_ptr->return_fiber(thread_id, current_fiber);
+          refresh_victims();
+          prune_dead_job_handles();
+          pool_ptr->poll_timers();
+          // a retiring worker stops taking shared work and waits out the nodes it handed out
+          if(retiring) {
+            if(is_drained()) {
+              break;
+            }
+            if(!has_local_work()) {
+              std::this_thread::yield();
+              continue;
+            }
+          } else if(!pool_ptr->has_work(this)) {
+            idle();
+            continue;
+          }
+          // woken fibers are resumed before any new job gets a fiber, and a fiber is only
+          // created once there is a job for it, sized by the job's stack class. pinned fibers
+          // and jobs come before the shared ones
+          FiberHandle next_fiber = pull_pinned_fiber();
+          if(!next_fiber && !retiring) {
+            next_fiber = pool_ptr->pull_ready_fiber(thread_id);
+          }
+          const b8 resuming = next_fiber != nullptr;
+          if(!next_fiber) {
+            const b8 pinned = pinned_jobs.pop(thread_id, &next_job);
+            if(!pinned) {
+              if(retiring) {
+                next_job = Job{};
+                pop_any_local_job(&next_job);
+              } else {
+                next_job = pool_ptr->pull_job(thread_id);
+              }
+            }
+            if(!next_job) {
+              continue;
+            }
+            if(!next_job.get_may_wait()) {
+              run_inline(next_job);
+              continue;
+            }
+            next_fiber = pool_ptr->create_fiber(next_job.get_stack(), cpu.node);
+            if(pinned) {
+              pool_ptr->home_of(next_fiber) = (u32)thread_id;
+              homed_fibers++;
             }
-            prune_dead_fiber_handles();
           }
           Fiber here = Fiber();
-          fiber_node_handle_t wait_handle = create_waiter();
-          current_fiber = pool_ptr->pull_fiber(thread_id, wait_handle);
+          current_fiber = next_fiber;
+          LOFI_TRACE(trace, FiberSwap, resuming);
+          fiber::set_current_locals(current_fiber->get_locals());
           current_fiber->swap(&here);
+          fiber::set_current_locals(nullptr);
+          if(pending_wait) {
+            // from here on another worker may resume the fiber
+            fiber_node_handle_t waiting = pending_wait;
+            pending_wait = nullptr;
+            current_fiber = nullptr;
+            pool_ptr->register_waiter(waiting);
+          } else {
+            pool_ptr->return_fiber(thread_id, current_fiber);
+            current_fiber = nullptr;
+          }
         }
         //execute_termination_tasks();
       }
@@ -441,41 +1489,124 @@ namespace lofi {
       tls_t _tls{nullptr};
       size_t thread_id;
       volatile FiberHandle current_fiber = nullptr;
-      fiber_handle_pool_t handle_pool{nullptr};
-      dead_fiber_handles_t dead_handles{nullptr};
+      fiber_node_handle_t pending_wait = nullptr;
+      Job next_job;                           // handed to the next fresh fiber
       job_handle_pool_t job_pool{nullptr};
       dead_job_handles_t dead_job_handles{nullptr};
-      std::thread _thread;
+      job_deque_t local_jobs[job::PriorityCount];
+      task_queue_t pinned_jobs;               // any thread pushes, only this worker pops
+      ready_fiber_list_t pinned_ready;        // woken fibers of pinned jobs
+      u64 steal_seed = 0;
+      u32 priority_age[job::PriorityCount] = {};
+      topology::cpu cpu;
+      u16 victims[NumThreads] = {};
+      u32 victim_tier_end[topology::DistanceCount] = {};
+      u32 victim_count = 0;
+      u32 victim_epoch = 0;
+      u32 homed_fibers = 0;                   // pinned fibers parked or running, owner only
+      trace_ring_t trace;
       volatile b8 should_halt = false;
+      volatile b8 retiring = false;
+      std::thread _thread;                    // last, run_kernel starts before the constructor body
     };
 
-    Worker* get_host_worker() {
-      Fiber here = Fiber();
-      for(size_t i = 0; i < num_workers; i++) {
-        Worker* worker = _workers[i];
-        //PRINT("checking WORKER ID = %llu\n", worker->get_thread_id());
-        if(worker->owns(&here)) {
-          return worker;
+    // parks the calling fiber until counter reaches target. jobs running without a fiber and
+    // threads outside the pool have nothing to park and yield to the os instead
+    void wait_for(atomic_counter<>* counter, const u64 target) {
+      Worker* worker = get_worker_context();
+      if(worker && worker->get_current_fiber()) {
+        worker->fiber_wait(counter, target);
+        return;
+      }
+      while(!counter->reached(target)) {
+        std::this_thread::yield();
+      }
+    }
+
+    // same as above but gives up after timeout_ns, returns whether the target was reached
+    b8 wait_for(atomic_counter<>* counter, const u64 target, const u64 timeout_ns) {
+      Worker* worker = get_worker_context();
+      if(worker && worker->get_current_fiber()) {
+        return worker->fiber_wait(counter, target, timeout_ns);
+      }
+      const u64 deadline = timer::now_ns() + timeout_ns;
+      while(!counter->reached(target)) {
+        if(timer::now_ns() >= deadline) {
+          return false;
         }
+        std::this_thread::yield();
+      }
+      return true;
+    }
+
+    // parks the calling fiber for at least duration_ns, the worker keeps running other jobs
+    void sleep_for(const u64 duration_ns) {
+      atomic_counter<> never{0};
+      wait_for(&never, 1, duration_ns);
+    }
+
+    // non worker threads still get worker 0
+    Worker* get_host_worker() {
+      Worker* worker = get_worker_context();
+      if(worker) [[likely]] {
+        return worker;
       }
-      //PRINT_S("failed to find host worker, returning worker 0\n");
       return _workers[0];
     }
 
+    // the calling worker's id, threads outside the pool share NumThreads. for per thread state
+    // that must never be touched by two threads at once, get_host_worker would hand out worker 0
+    static const u64 get_thread_slot() {
+      Worker* worker = get_worker_context();
+      return worker ? (u64)worker->get_thread_id() : NumThreads;
+    }
+
+    // set once per worker thread, fibers migrating between threads pick up the new
+    // worker because the read is never inlined into the fiber's code
+    static FORCENOINLINE Worker* get_worker_context() {
+      return host_worker;
+    }
+
   private:
-    Worker** _workers;
+    static inline thread_local Worker* host_worker = nullptr;
+    Worker** _workers;                      // NumThreads slots, the first num_workers are running
+    void* worker_storage[NumThreads];
 
-    task_queue_t high_priority_job_queue;
-    task_queue_t mid_priority_job_queue;
-    task_queue_t low_priority_job_queue;
+    // shared per node and priority queues, fed by non worker threads and by local deque overflow
+    task_queue_t job_queues[LOFI_MAX_NUMA_NODES][job::PriorityCount];
 
     task_queue_t reactor_queue;
-    waiting_fiber_list_t waiting_fiber_list;
-    stack_pool_t stack_pool;
+    ready_fiber_list_t ready_fiber_list;
+    small_stack_pool_t small_stacks[LOFI_MAX_NUMA_NODES];
+    default_stack_pool_t default_stacks[LOFI_MAX_NUMA_NODES];
+    large_stack_pool_t large_stacks[LOFI_MAX_NUMA_NODES];
+    topology::CpuTopology _topology;
+    u32 num_nodes = 1;
+    b8 pin_workers = LOFI_PIN_WORKERS;
+    std::atomic<u64> current_frame{0};
     fiber_pool_t fiber_pool;
+    u32 fiber_home[NumFibers];              // by fiber pool slot, MAX_u32 when any worker may resume it
     atomic_counter<> thread_local_task_counter{0};
+
+    idle_config _idle_config{};
+    std::mutex park_mutex;
+    std::condition_variable park_signal;
+    std::atomic<u32> sleeping_workers{0};
+    std::atomic<u32> idle_workers{0};
+    u32 wake_tokens = 0;                    // guarded by park_mutex
+    atomic_counter<> spin_hits{0};
+    atomic_counter<> parks{0};
+    atomic_counter<> wakes{0};
+    atomic_counter<> park_timeouts{0};
+    atomic_counter<> wake_requests{0};
     //HeapAllocator<0> local_memory_pool;
-    u8 num_workers = 0;
+    pool_config _config{};
+    std::mutex resize_mutex;
+    std::atomic<u32> num_workers{0};
+    std::atomic<u32> worker_epoch{0};       // bumped whenever a worker is added or retired
+    timer_wheel_t timers;
+    std::atomic<b8> timer_watcher{false};   // a parked worker is sleeping until the next timer
+    u32 timer_epoch = 0;                    // guarded by park_mutex
   };
 
   template<size_t T, size_t F>
@@ -484,11 +1615,17 @@ namespace lofi {
     using worker_t = typename pool_t::Worker;
     worker_t* worker = GET_HOST_WORKER(pool_t);
     //PRINT("worker %llu entered fiber main\n", worker->get_thread_id());
-    Job job = GET_THREAD_POOL(pool_t)->pull_job(worker->get_thread_id());
-    job.set_obj((void*)GET_THREAD_POOL(pool_t));
-    if(!job.run()) {
-      using namespace std::chrono_literals;
-      std::this_thread::sleep_for(1ms);
+    Job job = worker->next_job;
+    worker->next_job = Job{};
+    if(job) {
+      // jobs without their own object get the pool, as before
+      if(!job.get_obj()) {
+        job.set_obj((void*)GET_THREAD_POOL(pool_t));
+      }
+      LOFI_TRACE(worker->trace, JobBegin, job.get_start());
+      job.run();
+      worker = GET_HOST_WORKER(pool_t);
+      LOFI_TRACE(worker->trace, JobEnd, job.get_start());
     }
     worker = GET_HOST_WORKER(pool_t);
     worker->yield();
@@ -0,0 +1,298 @@
+// =====================================================================================
+//
+//       Filename:  l_timer.hpp
+//
+//    Description:  hierarchical timer wheel, advanced by whichever worker gets to it
+//
+//        Version:  1.0
+//        Created:  2026-10-18 7:12:26 PM
+//       Revision:  none
+//       Compiler:  g++
+//
+//         Author:  Roxi Graves (rg), nada
+//   Organization:  Roxi Psychotronics
+//
+// =====================================================================================
+#pragma once
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <thread>
+#include "l_base.hpp"
+#include "l_vocab.hpp"
+
+// wheel resolution, a timer fires on the first tick at or after its deadline
+#ifndef LOFI_TIMER_TICK_NS
+#define LOFI_TIMER_TICK_NS 100000
+#endif
+
+// 64 slots per level, four levels at 100us ticks span about 27 minutes. anything further out
+// parks in the top level and is placed again once it comes around
+#ifndef LOFI_TIMER_LEVELS
+#define LOFI_TIMER_LEVELS 4
+#endif
+
+namespace lofi {
+  namespace timer {
+
+    static u64 now_ns() {
+      return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    enum class State : u8 {
+      Idle = 0,
+      Pending,
+    };
+
+    // intrusive, the wheel never owns it. the wheel is done with a timer once firing drops
+    // back to false, a periodic one is queued for its next period before fire runs
+    struct node {
+      node* next = nullptr;
+      node* prev = nullptr;
+      node* fire_next = nullptr;
+      u64 deadline = 0;                     // steady clock ns
+      u64 period = 0;                       // 0 fires once
+      void (*fire)(node*) = nullptr;
+      void* data = nullptr;
+      u16 bucket = 0;
+      State state = State::Idle;            // guarded by the wheel lock
+      std::atomic<b8> firing{false};        // set from the tick it is due until fire returns, a
+                                            // period that comes up while the last one is still
+                                            // firing is dropped
+    };
+
+    template<u32 Levels = LOFI_TIMER_LEVELS, u64 TickNs = LOFI_TIMER_TICK_NS>
+    class Wheel {
+    public:
+      static constexpr u32 SlotBits = 6;
+      static constexpr u32 Slots = 1u << SlotBits;
+      static_assert(Levels > 0 && Levels * SlotBits < 64, "timer wheel has too many levels");
+
+      Wheel() : start{now_ns()} {}
+
+      Wheel(const Wheel&) = delete;
+      Wheel& operator=(const Wheel&) = delete;
+
+      // deadline and period have to be set, a deadline in the past fires on the next advance
+      void schedule(node* timer) {
+        lock();
+        L_ASSERT(timer->state != State::Pending && "timer scheduled twice");
+        timer->state = State::Pending;
+        insert(timer, MAX(to_tick(timer->deadline), current_tick + 1));
+        count.fetch_add(1, std::memory_order_relaxed);
+        update_next_due();
+        unlock();
+      }
+
+      // true when the timer was pending and will not fire, a callback for a tick that already
+      // came up may still be running, see quiesce
+      b8 cancel(node* timer) {
+        lock();
+        const b8 pending = timer->state == State::Pending;
+        if(pending) {
+          unlink(timer);
+          timer->state = State::Idle;
+          count.fetch_sub(1, std::memory_order_relaxed);
+          update_next_due();
+        }
+        unlock();
+        return pending;
+      }
+
+      // waits out a fire of the timer that is in flight, after a cancel or a one shot that came
+      // due the timer may be freed once this returns. never call it from the timer's own fire
+      void quiesce(node* timer) {
+        while(timer->firing.load(std::memory_order_acquire)) {
+          std::this_thread::yield();
+        }
+      }
+
+      // fires every timer due at now, returns how many fired. only one thread advances at a
+      // time, the others return right away
+      u32 advance(u64 now) {
+        if(!is_due(now) || lock_flag.test_and_set(std::memory_order_acquire)) {
+          return 0;
+        }
+        const u64 target = now > start ? (now - start) / TickNs : 0;
+        node* due = nullptr;
+        node* due_last = nullptr;
+        while(current_tick < target) {
+          // jumps straight over empty stretches of the wheel
+          const u64 next_tick = next_event_tick();
+          if(next_tick > target) {
+            current_tick = target;
+            break;
+          }
+          current_tick = next_tick - 1;
+          step(&due, &due_last, now);
+        }
+        update_next_due();
+        lock_flag.clear(std::memory_order_release);
+
+        u32 fired = 0;
+        while(due) {
+          node* next = due->fire_next;
+          due->fire(due);
+          due->firing.store(false, std::memory_order_release);   // last touch, the owner may free it
+          due = next;
+          fired++;
+        }
+        return fired;
+      }
+
+      const b8 is_empty() const {
+        return count.load(std::memory_order_relaxed) == 0;
+      }
+
+      const b8 is_due(u64 now) const {
+        return now >= next_due.load(std::memory_order_acquire);
+      }
+
+      // steady clock ns of the next tick that has work, MAX_u64 when the wheel is empty
+      const u64 get_next_due() const {
+        return next_due.load(std::memory_order_acquire);
+      }
+
+      const u32 get_size() const {
+        return count.load(std::memory_order_relaxed);
+      }
+
+    private:
+      void lock() {
+        while(lock_flag.test_and_set(std::memory_order_acquire)) {}
+      }
+
+      void unlock() {
+        lock_flag.clear(std::memory_order_release);
+      }
+
+      // rounded up, so no timer fires early
+      u64 to_tick(u64 ns) const {
+        return ns > start ? (ns - start + TickNs - 1) / TickNs : 0;
+      }
+
+      // the level is the highest 6 bit group where tick and the current tick differ. the top
+      // level also takes the slots of its next lap, and anything past that waits in the slot
+      // it comes to last
+      void insert(node* timer, u64 tick) {
+        const u64 difference = tick ^ current_tick;
+        u32 level = difference ? (63 - (u32)std::countl_zero(difference)) / SlotBits : 0;
+        u32 slot = (u32)(tick >> (level * SlotBits)) & (Slots - 1);
+        if(level >= Levels) {
+          level = Levels - 1;
+          const u32 shift = level * SlotBits;
+          const u64 groups_ahead = (tick >> shift) - (current_tick >> shift);
+          slot = (u32)((groups_ahead < Slots ? tick >> shift : (current_tick >> shift) - 1) & (Slots - 1));
+        }
+        node*& head = slots[level][slot];
+        timer->bucket = (u16)(level * Slots + slot);
+        timer->prev = nullptr;
+        timer->next = head;
+        if(head) {
+          head->prev = timer;
+        }
+        head = timer;
+        occupied[level] |= 1ull << slot;
+      }
+
+      void unlink(node* timer) {
+        const u32 level = timer->bucket / Slots;
+        const u32 slot = timer->bucket % Slots;
+        if(timer->prev) {
+          timer->prev->next = timer->next;
+        } else {
+          slots[level][slot] = timer->next;
+        }
+        if(timer->next) {
+          timer->next->prev = timer->prev;
+        }
+        if(!slots[level][slot]) {
+          occupied[level] &= ~(1ull << slot);
+        }
+        timer->next = nullptr;
+        timer->prev = nullptr;
+      }
+
+      node* take_slot(u32 level, u32 slot) {
+        node* list = slots[level][slot];
+        slots[level][slot] = nullptr;
+        occupied[level] &= ~(1ull << slot);
+        return list;
+      }
+
+      // moves one tick forward, higher levels are spread over the lower ones as their slot comes up
+      void step(node** due, node** due_last, u64 now) {
+        current_tick++;
+        for(u32 level = 1; level < Levels; level++) {
+          if(current_tick & ((1ull << (level * SlotBits)) - 1)) {
+            break;
+          }
+          node* list = take_slot(level, (u32)(current_tick >> (level * SlotBits)) & (Slots - 1));
+          while(list) {
+            node* next = list->next;
+            insert(list, MAX(to_tick(list->deadline), current_tick));
+            list = next;
+          }
+        }
+        node* list = take_slot(0, (u32)current_tick & (Slots - 1));
+        while(list) {
+          node* next = list->next;
+          if(!list->firing.exchange(true, std::memory_order_acq_rel)) {
+            list->fire_next = nullptr;
+            if(*due_last) {
+              (*due_last)->fire_next = list;
+            } else {
+              *due = list;
+            }
+            *due_last = list;
+          }
+          if(list->period) {
+            // missed periods are skipped rather than fired back to back
+            list->deadline += list->period;
+            if(list->deadline <= now) {
+              list->deadline = now + list->period;
+            }
+            insert(list, MAX(to_tick(list->deadline), current_tick + 1));
+          } else {
+            list->state = State::Idle;
+            count.fetch_sub(1, std::memory_order_relaxed);
+          }
+          list = next;
+        }
+      }
+
+      // the first tick at which the wheel has to fire or cascade something, lower levels always
+      // come before the next cascade of the level above them
+      u64 next_event_tick() const {
+        for(u32 level = 0; level < Levels; level++) {
+          if(!occupied[level]) {
+            continue;
+          }
+          const u32 shift = level * SlotBits;
+          const u32 current = (u32)(current_tick >> shift) & (Slots - 1);
+          const u64 ahead = std::rotr(occupied[level], (int)((current + 1) & (Slots - 1)));
+          const u64 distance = (u64)std::countr_zero(ahead) + 1;
+          if(!level) {
+            return current_tick + distance;
+          }
+          return ((current_tick >> shift) + distance) << shift;
+        }
+        return MAX_u64;
+      }
+
+      void update_next_due() {
+        const u64 tick = next_event_tick();
+        next_due.store(tick == MAX_u64 ? MAX_u64 : start + tick * TickNs, std::memory_order_release);
+      }
+
+      node* slots[Levels][Slots] = {};
+      u64 occupied[Levels] = {};
+      u64 current_tick = 0;
+      const u64 start;
+      std::atomic<u64> next_due{MAX_u64};
+      std::atomic<u32> count{0};
+      std::atomic_flag lock_flag = ATOMIC_FLAG_INIT;
+    };
+
+  }		// -----  end of namespace timer  ----- 
+}		// -----  end of namespace lofi  ----- 
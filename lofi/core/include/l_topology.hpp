@@ -0,0 +1,293 @@
+// =====================================================================================
+//
+//       Filename:  l_topology.hpp
+//
+//    Description:  cpu topology discovery and thread pinning
+//
+//        Version:  1.0
+//        Created:  2026-10-18 3:05:51 PM
+//       Revision:  none
+//       Compiler:  g++
+//
+//         Author:  Roxi Graves (rg), nada
+//   Organization:  Roxi Psychotronics
+//
+// =====================================================================================
+#pragma once
+#include <stdio.h>
+#include <thread>
+#include "l_base.hpp"
+#include "l_vocab.hpp"
+
+#if(OS_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifndef LOFI_MAX_CPUS
+#define LOFI_MAX_CPUS 256
+#endif
+
+// nodes past this are folded onto the ones below it
+#ifndef LOFI_MAX_NUMA_NODES
+#define LOFI_MAX_NUMA_NODES 4
+#endif
+
+namespace lofi {
+  namespace topology {
+
+    // how far apart two hardware threads are, closer victims are stolen from first
+    enum class Distance : u8 {
+      SameCore = 0,
+      SameCache,
+      SameNode,
+      Remote,
+      Count
+    };
+
+    static constexpr u8 DistanceCount = (u8)Distance::Count;
+
+    struct cpu {
+      u16 id = 0;                 // os cpu number
+      u16 core = 0;               // physical core, unique across packages
+      u16 cache = 0;              // last level cache domain
+      u16 node = 0;               // numa node
+      u16 package = 0;
+      b8 primary = true;          // first hardware thread of its core
+    };
+
+    static Distance distance(const cpu& a, const cpu& b) {
+      if(a.core == b.core) {
+        return Distance::SameCore;
+      }
+      if(a.cache == b.cache) {
+        return Distance::SameCache;
+      }
+      if(a.node == b.node) {
+        return Distance::SameNode;
+      }
+      return Distance::Remote;
+    }
+
+    namespace helpers {
+      static b8 read_u32(const char* path, u32* result) {
+        FILE* file = fopen(path, "r");
+        if(!file) {
+          return false;
+        }
+        const b8 found = fscanf(file, "%u", result) == 1;
+        fclose(file);
+        return found;
+      }
+
+      // parses sysfs cpu lists like "0-3,8,10-11" into a membership table
+      static u32 read_cpu_list(const char* path, b8* members, u32 max_cpus) {
+        FILE* file = fopen(path, "r");
+        if(!file) {
+          return 0;
+        }
+        u32 count = 0;
+        u32 first = 0;
+        while(fscanf(file, "%u", &first) == 1) {
+          u32 last = first;
+          int separator = fgetc(file);
+          if(separator == '-') {
+            if(fscanf(file, "%u", &last) != 1) {
+              break;
+            }
+            separator = fgetc(file);
+          }
+          for(u32 i = first; i <= last && i < max_cpus; i++) {
+            if(!members[i]) {
+              members[i] = true;
+              count++;
+            }
+          }
+          if(separator != ',') {
+            break;
+          }
+        }
+        fclose(file);
+        return count;
+      }
+
+      // dense index for a sparse key, keys has to hold at least LOFI_MAX_CPUS entries
+      static u16 intern(u32* keys, u32* key_count, u32 key) {
+        for(u32 i = 0; i < *key_count; i++) {
+          if(keys[i] == key) {
+            return (u16)i;
+          }
+        }
+        keys[*key_count] = key;
+        return (u16)(*key_count)++;
+      }
+    }		// -----  end of namespace helpers  ----- 
+
+    class CpuTopology {
+    public:
+      CpuTopology() {}
+
+      // reads the layout from sysfs, anything it cannot find is treated as one flat node
+      b8 discover() {
+        const u32 hardware_threads = MAX(std::thread::hardware_concurrency(), 1u);
+#if(OS_LINUX)
+        b8 online[LOFI_MAX_CPUS] = {};
+        if(!helpers::read_cpu_list("/sys/devices/system/cpu/online", online, LOFI_MAX_CPUS)) {
+          discover_flat(hardware_threads);
+          return false;
+        }
+        u16 node_of[LOFI_MAX_CPUS] = {};
+        u32 node_keys[LOFI_MAX_CPUS];
+        u32 node_key_count = 0;
+        char path[128];
+        for(u32 node = 0; node < LOFI_MAX_CPUS; node++) {
+          b8 members[LOFI_MAX_CPUS] = {};
+          snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+          if(!helpers::read_cpu_list(path, members, LOFI_MAX_CPUS)) {
+            continue;
+          }
+          const u16 dense = (u16)(helpers::intern(node_keys, &node_key_count, node) % LOFI_MAX_NUMA_NODES);
+          for(u32 i = 0; i < LOFI_MAX_CPUS; i++) {
+            if(members[i]) {
+              node_of[i] = dense;
+            }
+          }
+        }
+
+        u32 core_keys[LOFI_MAX_CPUS];
+        u32 core_key_count = 0;
+        u32 cache_keys[LOFI_MAX_CPUS];
+        u32 cache_key_count = 0;
+        cpu_count = 0;
+        for(u32 i = 0; i < LOFI_MAX_CPUS; i++) {
+          if(!online[i]) {
+            continue;
+          }
+          u32 package = 0;
+          u32 core = i;
+          u32 cache = MAX_u32;
+          snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", i);
+          helpers::read_u32(path, &package);
+          snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/core_id", i);
+          helpers::read_u32(path, &core);
+          snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index3/id", i);
+          if(!helpers::read_u32(path, &cache)) {
+            cache = MAX_u16;                        // no l3 info, one domain per package
+          }
+          const u32 core_count_before = core_key_count;
+          cpu& info = cpus[cpu_count++];
+          info.id = (u16)i;
+          info.package = (u16)package;
+          info.node = node_of[i];
+          info.core = helpers::intern(core_keys, &core_key_count, (package << 16) | (core & MAX_u16));
+          info.cache = helpers::intern(cache_keys, &cache_key_count, (package << 16) | (cache & MAX_u16));
+          info.primary = core_key_count != core_count_before;
+        }
+        core_count = core_key_count;
+        cache_count = cache_key_count;
+        node_count = MAX(MIN(node_key_count, (u32)LOFI_MAX_NUMA_NODES), 1u);
+        sort_placement();
+        return true;
+#else
+        discover_flat(hardware_threads);
+        return false;
+#endif
+      }
+
+      const u32 get_cpu_count() const {
+        return cpu_count;
+      }
+
+      const u32 get_core_count() const {
+        return core_count;
+      }
+
+      const u32 get_cache_count() const {
+        return cache_count;
+      }
+
+      const u32 get_node_count() const {
+        return node_count;
+      }
+
+      const cpu& get_cpu(u32 index) const {
+        return cpus[index];
+      }
+
+      // the cpu the n-th worker should sit on, fills one thread per physical core, node by node
+      // and cache by cache, before handing out smt siblings
+      const cpu& get_worker_cpu(u32 worker) const {
+        return cpus[placement[worker % cpu_count]];
+      }
+
+    private:
+      void discover_flat(u32 count) {
+        cpu_count = MIN(count, (u32)LOFI_MAX_CPUS);
+        for(u32 i = 0; i < cpu_count; i++) {
+          cpus[i] = cpu{};
+          cpus[i].id = (u16)i;
+          cpus[i].core = (u16)i;
+        }
+        core_count = cpu_count;
+        cache_count = 1;
+        node_count = 1;
+        sort_placement();
+      }
+
+      b8 placed_before(const cpu& a, const cpu& b) const {
+        if(a.primary != b.primary) {
+          return a.primary;
+        }
+        if(a.node != b.node) {
+          return a.node < b.node;
+        }
+        if(a.cache != b.cache) {
+          return a.cache < b.cache;
+        }
+        if(a.core != b.core) {
+          return a.core < b.core;
+        }
+        return a.id < b.id;
+      }
+
+      void sort_placement() {
+        for(u32 i = 0; i < cpu_count; i++) {
+          placement[i] = (u16)i;
+        }
+        for(u32 i = 1; i < cpu_count; i++) {
+          const u16 current = placement[i];
+          u32 j = i;
+          while(j > 0 && placed_before(cpus[current], cpus[placement[j - 1]])) {
+            placement[j] = placement[j - 1];
+            j--;
+          }
+          placement[j] = current;
+        }
+      }
+
+      cpu cpus[LOFI_MAX_CPUS];
+      u16 placement[LOFI_MAX_CPUS] = {};
+      u32 cpu_count = 0;
+      u32 core_count = 0;
+      u32 cache_count = 0;
+      u32 node_count = 1;
+    };
+
+    static b8 pin_current_thread(u32 cpu_id) {
+#if(OS_WINDOWS)
+      if(cpu_id >= 64) {
+        return false;
+      }
+      return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu_id) != 0;
+#elif(OS_LINUX)
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu_id, &set);
+      return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+      return false;
+#endif
+    }
+
+  }		// -----  end of namespace topology  ----- 
+}		// -----  end of namespace lofi  ----- 
@@ -0,0 +1,239 @@
+// =====================================================================================
+//
+//       Filename:  l_trace.hpp
+//
+//    Description:  per worker scheduler event rings and chrome trace export
+//
+//        Version:  1.0
+//        Created:  2026-10-18 4:22:09 PM
+//       Revision:  none
+//       Compiler:  g++
+//
+//         Author:  Roxi Graves (rg), nada
+//   Organization:  Roxi Psychotronics
+//
+// =====================================================================================
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+#include "l_base.hpp"
+#include "l_vocab.hpp"
+
+#if defined(_M_X64)
+#include <intrin.h>
+#elif defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// compiles every trace point out, the rings shrink to nothing
+#ifndef LOFI_NO_TRACING
+#define LOFI_NO_TRACING 0
+#endif
+
+// events kept per worker between drains, has to be a power of two
+#ifndef LOFI_TRACE_CAPACITY
+#define LOFI_TRACE_CAPACITY 4096
+#endif
+
+#if LOFI_NO_TRACING
+#define LOFI_TRACE(ring, event, data)
+#else
+#define LOFI_TRACE(ring, event, data) (ring).record(lofi::trace::Event::event, (u32)(data))
+#endif
+
+namespace lofi {
+  namespace trace {
+
+    enum class Event : u8 {
+      JobBegin = 0,     // data = job start
+      JobEnd,           // data = job start
+      FiberSwap,        // data = 1 when resuming a fiber that waited
+      Wait,             // data = target count
+      Resume,
+      Steal,            // data = victim worker
+      ParkBegin,
+      ParkEnd,          // data = 1 when woken, 0 on timeout
+      Count
+    };
+
+    static constexpr u8 EventCount = (u8)Event::Count;
+
+    // 16 bytes, the timestamp is in raw clock ticks
+    struct record {
+      u64 timestamp = 0;
+      u32 data = 0;
+      Event event = Event::Count;
+    };
+
+    static i64 now_ns() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // the tsc where there is one, it is a few cycles instead of a clock call
+    static u64 now() {
+#if defined(_M_X64) || defined(__x86_64__)
+      return __rdtsc();
+#else
+      return (u64)now_ns();
+#endif
+    }
+
+    // maps ticks onto steady clock microseconds, measured once over a short window
+    struct clock_map {
+      u64 ticks = 0;
+      i64 ns = 0;
+      f64 ns_per_tick = 1.0;
+
+      void calibrate() {
+        const u64 begin_ticks = now();
+        const i64 begin_ns = now_ns();
+        while(now_ns() - begin_ns < 5'000'000) {
+          std::this_thread::yield();
+        }
+        ticks = now();
+        ns = now_ns();
+        ns_per_tick = (f64)(ns - begin_ns) / (f64)MAX(ticks - begin_ticks, (u64)1);
+      }
+
+      f64 to_us(u64 timestamp) const {
+        return ((f64)ns + ((f64)(i64)(timestamp - ticks)) * ns_per_tick) / 1000.0;
+      }
+    };
+
+#if LOFI_NO_TRACING
+
+    template<u32 Capacity>
+    class Ring {
+    public:
+      void record(Event event, u32 data) {}
+
+      template<typename sink_t>
+      u64 drain(sink_t& sink, u32 worker) {
+        return 0;
+      }
+
+      const u64 get_dropped() const {
+        return 0;
+      }
+    };
+
+#else
+
+    // single producer, the owning worker, and a single drainer at a time. a full ring drops new
+    // events and counts them instead of ever blocking the worker
+    template<u32 Capacity>
+    class Ring {
+    public:
+      static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "trace ring capacity must be a power of two");
+
+      void record(Event event, u32 data) {
+        const u64 current_head = head.load(std::memory_order_relaxed);
+        if(current_head - tail.load(std::memory_order_acquire) >= Capacity) {
+          dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+          return;
+        }
+        trace::record& entry = entries[current_head & (Capacity - 1)];
+        entry.timestamp = now();
+        entry.data = data;
+        entry.event = event;
+        head.store(current_head + 1, std::memory_order_release);
+      }
+
+      // hands every event recorded so far to sink.write(worker, record)
+      template<typename sink_t>
+      u64 drain(sink_t& sink, u32 worker) {
+        u64 current_tail = tail.load(std::memory_order_relaxed);
+        const u64 current_head = head.load(std::memory_order_acquire);
+        const u64 count = current_head - current_tail;
+        for(; current_tail != current_head; current_tail++) {
+          sink.write(worker, entries[current_tail & (Capacity - 1)]);
+        }
+        tail.store(current_tail, std::memory_order_release);
+        return count;
+      }
+
+      const u64 get_dropped() const {
+        return dropped.load(std::memory_order_relaxed);
+      }
+
+    private:
+      alignas(64) std::atomic<u64> head{0};
+      alignas(64) std::atomic<u64> tail{0};
+      std::atomic<u64> dropped{0};
+      trace::record entries[Capacity];
+    };
+
+#endif
+
+    // chrome trace event json, opens in chrome://tracing and ui.perfetto.dev. jobs are duration
+    // slices per worker, a wait closes the slice and the resume opens a new one on whichever
+    // worker picked the fiber up
+    class ChromeWriter {
+    public:
+      ChromeWriter() {}
+
+      ~ChromeWriter() {
+        close();
+      }
+
+      b8 open(const char* path) {
+        file = fopen(path, "w");
+        if(!file) {
+          return false;
+        }
+        clock.calibrate();
+        first = true;
+        fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+        return true;
+      }
+
+      void close() {
+        if(file) {
+          fprintf(file, "\n]}\n");
+          fclose(file);
+          file = nullptr;
+        }
+      }
+
+      void name_worker(u32 worker) {
+        begin_entry();
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"worker %u\"}}", worker, worker);
+      }
+
+      void write(u32 worker, const record& entry) {
+        const char* name = "";
+        const char* phase = "i";
+        switch(entry.event) {
+          case Event::JobBegin:  name = "job";    phase = "B"; break;
+          case Event::JobEnd:    name = "job";    phase = "E"; break;
+          case Event::Resume:    name = "job";    phase = "B"; break;
+          case Event::Wait:      name = "job";    phase = "E"; break;
+          case Event::ParkBegin: name = "park";   phase = "B"; break;
+          case Event::ParkEnd:   name = "park";   phase = "E"; break;
+          case Event::FiberSwap: name = "swap";   break;
+          case Event::Steal:     name = "steal";  break;
+          default: return;
+        }
+        begin_entry();
+        fprintf(file, "{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":0,\"tid\":%u", name, phase, clock.to_us(entry.timestamp), worker);
+        if(phase[0] == 'i') {
+          fprintf(file, ",\"s\":\"t\"");
+        }
+        fprintf(file, ",\"args\":{\"data\":%u}}", entry.data);
+      }
+
+    private:
+      void begin_entry() {
+        fprintf(file, first ? "\n" : ",\n");
+        first = false;
+      }
+
+      FILE* file = nullptr;
+      clock_map clock;
+      b8 first = true;
+    };
+
+  }		// -----  end of namespace trace  ----- 
+}		// -----  end of namespace lofi  ----- 
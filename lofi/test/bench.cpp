@@ -0,0 +1,789 @@
+// =====================================================================================
+//
+//       Filename:  bench.cpp
+//
+//    Description:  scheduler and allocator benchmarks
+//
+//        Version:  1.0
+//        Created:  2026-10-18 10:12:40 AM
+//       Revision:  none
+//       Compiler:  g++
+//
+//         Author:  Roxi Graves (rg), nada
+//   Organization:  Roxi Psychotronics
+//
+// =====================================================================================
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#define LOFI_DEFAULT_BUCKETS_COUNT 4
+#include "../core/include/l_thread_pool.hpp"
+
+// free lookup sets, 4, 8 and 16 buckets of 16 byte steps
+namespace lofi {
+  namespace mem {
+    template<size_t... Is>
+      using free_lookup_set_t = List<BucketDescriptor<16 * (Is + 1), 2048, 16>...>;
+
+    template<>
+      struct BucketDescriptorSet<5> {
+        using type = free_lookup_set_t<0, 1, 2, 3>;
+      };
+
+    template<>
+      struct BucketDescriptorSet<6> {
+        using type = free_lookup_set_t<0, 1, 2, 3, 4, 5, 6, 7>;
+      };
+
+    template<>
+      struct BucketDescriptorSet<7> {
+        using type = free_lookup_set_t<0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15>;
+      };
+
+    // allocator scaling, one set shared by every thread and one per thread for the per thread mode
+    using scaling_set_t = List<BucketDescriptor<16, 4096, 16>, BucketDescriptor<32, 4096, 16>
+                              , BucketDescriptor<64, 4096, 16>, BucketDescriptor<128, 4096, 16>>;
+
+#define SCALING_SET(id) template<> struct BucketDescriptorSet<id> { using type = scaling_set_t; };
+    SCALING_SET(8)
+    SCALING_SET(9)
+    SCALING_SET(10)
+    SCALING_SET(11)
+    SCALING_SET(12)
+    SCALING_SET(13)
+    SCALING_SET(14)
+    SCALING_SET(15)
+    SCALING_SET(16)
+#undef SCALING_SET
+  }		// -----  end of namespace mem  ----- 
+}		// -----  end of namespace lofi  ----- 
+
+using bench_clock_t = std::chrono::steady_clock;
+
+static constexpr u64 BenchNumFibers = 64;
+
+// a job node per leaf lives in the kicking worker's job_pool, so one round has to stay under MaxDeadJobs
+static constexpr u64 FanOut = 32;
+static constexpr u64 FanOutRounds = 2048;
+// a round records about 70 events over all workers, draining this often keeps every ring
+// far from its LOFI_TRACE_CAPACITY entries
+static constexpr u64 FanOutDrainRounds = 16;
+static constexpr u64 LeafWork = 2048;
+
+static volatile u64 leaf_sink[FanOut];
+
+static constexpr u64 LatencyNumFibers = 32;
+static constexpr u64 LatencyFanOut = 8;
+static constexpr u64 LatencyRounds = 1024;
+
+static std::atomic<i64> last_finish_ns{0};
+static u64 wake_latency_ns[LatencyRounds];
+
+static constexpr u64 ParallelForNumFibers = 16;
+static constexpr u64 ParallelForCount = 1 << 24;
+static constexpr u64 ParallelForWork = 64;
+
+static std::atomic<u64> parallel_for_total{0};
+static f64 parallel_for_ms = 0.0;
+
+static constexpr u64 ChainNumFibers = 8;
+static constexpr u64 ChainLength = 4096;
+
+static constexpr u64 QueueBenchThreads = 64;
+static constexpr u64 QueueBenchItems = 1 << 18;
+static constexpr u64 QueueBenchBatch = 16;
+
+using list_queue_t = lofi::lock_free_queue<u64, QueueBenchThreads>;
+using ring_queue_t = lofi::lock_free_queue<u64, QueueBenchThreads, lofi::BoundedRingPolicy<4096>>;
+
+static list_queue_t list_queue;
+static ring_queue_t ring_queue;
+
+static constexpr u64 SwapRounds = 1 << 22;
+
+static constexpr u64 FreeLookupBlocks = 2048;         // per bucket
+static constexpr u64 FreeLookupRounds = 64;
+static volatile u64 free_lookup_sink = 0;
+
+static constexpr u64 ScalingMaxThreads = 8;
+static constexpr u64 ScalingRounds = 1 << 15;
+static constexpr u64 ScalingLive = 32;                // blocks held at once by each thread
+static constexpr u64 ScalingSharedID = 8;
+static constexpr u64 ScalingPerThreadID = 9;
+static constexpr u64 scaling_sizes[] = {16, 32, 64, 128};
+static std::atomic<u64> scaling_failures{0};
+
+static constexpr u64 DispatchJobs = 1 << 22;
+static constexpr u64 DispatchNumFibers = 24;
+static constexpr u64 DispatchFanOut = 32;
+static constexpr u64 DispatchRounds = 4096;
+
+static volatile u64 dispatch_sink = 0;
+static f64 dispatch_scheduled_ns[3];
+
+// what callers of the function pointer path have to keep alive somewhere until the job runs
+struct dispatch_params {
+  u64 seed;
+  volatile u64* sink;
+};
+
+static dispatch_params dispatch_param_slots[DispatchFanOut];
+
+// a capture that does not fit inline
+struct dispatch_payload {
+  u64 words[8];
+};
+
+static i64 now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock_t::now().time_since_epoch()).count();
+}
+
+static f64 elapsed_ms(bench_clock_t::time_point begin) {
+  return std::chrono::duration<f64, std::milli>(bench_clock_t::now() - begin).count();
+}
+
+// tallies drained scheduler events per kind
+struct trace_tally {
+  u64 counts[lofi::trace::EventCount] = {};
+
+  void write(u32, const lofi::trace::record& entry) {
+    counts[(u8)entry.event]++;
+  }
+
+  u64 get(lofi::trace::Event event) const {
+    return counts[(u8)event];
+  }
+};
+
+static trace_tally fan_out_tally;
+
+DEFINE_JOB_SUCCESS(bench_job_success) {
+  lofi::atomic_counter<>* a_counter = (lofi::atomic_counter<>*) counter;
+  (*a_counter)++;
+}
+
+DEFINE_JOB_FAILURE(bench_job_failure) {
+  PRINT("bench job [%llu, %llu) failed\n", start, end);
+}
+
+// pushes a single root job from the main thread, runs the pool until it finishes and shuts it down
+template<typename pool_t>
+static f64 run_root(lofi::job::entry entry_point) {
+  typename pool_t::job_node_t node{};
+  lofi::atomic_counter<> terminate_gate{0};
+  lofi::Job root;
+  root.set_entry_point(entry_point);
+  root.set_job_success(bench_job_success);
+  root.set_job_failure(bench_job_failure);
+  root.set_job_start(0);
+  root.set_job_end(1);
+  root.set_job_counter(&terminate_gate);
+  node.data = root;
+
+  auto begin = bench_clock_t::now();
+  GET_THREAD_POOL(pool_t)->push_high_priority_job(0, &node);
+  GET_THREAD_POOL(pool_t)->run();
+  while(terminate_gate.get_count() < 1) {
+    std::this_thread::yield();
+  }
+  const f64 ms = elapsed_ms(begin);
+  GET_THREAD_POOL(pool_t)->terminate();
+  return ms;
+}
+
+DEFINE_JOB(fan_out_leaf) {
+  u64 result = start;
+  for(u64 i = 0; i < LeafWork; i++) {
+    result = result * 6364136223846793005ull + 1442695040888963407ull;
+  }
+  leaf_sink[start] = result;
+  return true;
+}
+
+template<size_t NumThreads>
+DEFINE_JOB(fan_out_root) {
+  using pool_t = lofi::ThreadPool<NumThreads, BenchNumFibers>;
+  using worker_t = typename pool_t::Worker;
+  pool_t* thread_pool = (pool_t*)param;
+  lofi::atomic_counter<> counter{0};
+  lofi::Job jobs[FanOut];
+  for(u64 round = 0; round < FanOutRounds; round++) {
+    for(u64 i = 0; i < FanOut; i++) {
+      jobs[i] = lofi::Job{};
+      jobs[i].set_entry_point(fan_out_leaf);
+      jobs[i].set_may_wait(false);
+      jobs[i].set_job_start(i);
+      jobs[i].set_job_end(i + 1);
+      jobs[i].set_job_counter(&counter);
+      jobs[i].set_job_success(bench_job_success);
+      jobs[i].set_job_failure(bench_job_failure);
+    }
+    // the fiber may resume on another worker after each wait
+    worker_t* worker = thread_pool->get_host_worker();
+    worker->kick_high_priority_jobs(jobs, FanOut);
+    worker = thread_pool->get_host_worker();
+    worker->fiber_wait(&counter, FanOut * (round + 1));
+    if(round % FanOutDrainRounds == FanOutDrainRounds - 1) {
+      thread_pool->drain_trace(fan_out_tally);
+    }
+  }
+  return true;
+}
+
+// stamps the finish time right before the increment that may wake the waiter
+DEFINE_JOB_SUCCESS(latency_job_success) {
+  last_finish_ns.store(now_ns(), std::memory_order_release);
+  lofi::atomic_counter<>* a_counter = (lofi::atomic_counter<>*) counter;
+  (*a_counter)++;
+}
+
+template<size_t NumThreads>
+DEFINE_JOB(wake_latency_root) {
+  using pool_t = lofi::ThreadPool<NumThreads, LatencyNumFibers>;
+  using worker_t = typename pool_t::Worker;
+  pool_t* thread_pool = (pool_t*)param;
+  lofi::atomic_counter<> counter{0};
+  lofi::Job jobs[LatencyFanOut];
+  for(u64 round = 0; round < LatencyRounds; round++) {
+    for(u64 i = 0; i < LatencyFanOut; i++) {
+      jobs[i] = lofi::Job{};
+      jobs[i].set_entry_point(fan_out_leaf);
+      jobs[i].set_may_wait(false);
+      jobs[i].set_job_start(i);
+      jobs[i].set_job_end(i + 1);
+      jobs[i].set_job_counter(&counter);
+      jobs[i].set_job_success(latency_job_success);
+      jobs[i].set_job_failure(bench_job_failure);
+    }
+    worker_t* worker = thread_pool->get_host_worker();
+    worker->kick_high_priority_jobs(jobs, LatencyFanOut);
+    worker = thread_pool->get_host_worker();
+    worker->fiber_wait(&counter, LatencyFanOut * (round + 1));
+    wake_latency_ns[round] = (u64)(now_ns() - last_finish_ns.load(std::memory_order_acquire));
+  }
+  return true;
+}
+
+template<size_t NumThreads>
+static void run_wake_latency() {
+  using pool_t = lofi::ThreadPool<NumThreads, LatencyNumFibers>;
+  run_root<pool_t>(wake_latency_root<NumThreads>);
+
+  u64 total = 0;
+  for(u64 i = 0; i < LatencyRounds; i++) {
+    total += wake_latency_ns[i];
+  }
+  std::sort(wake_latency_ns, wake_latency_ns + LatencyRounds);
+  PRINT("threads %2llu: avg %8llu ns, p50 %8llu ns, p99 %8llu ns, max %8llu ns\n",
+      (u64)NumThreads, total / LatencyRounds, wake_latency_ns[LatencyRounds / 2],
+      wake_latency_ns[(LatencyRounds * 99) / 100], wake_latency_ns[LatencyRounds - 1]);
+}
+
+DEFINE_JOB(parallel_for_body) {
+  u64 sum = 0;
+  for(u64 i = start; i < end; i++) {
+    u64 value = i;
+    for(u64 j = 0; j < ParallelForWork; j++) {
+      value = value * 6364136223846793005ull + 1442695040888963407ull;
+    }
+    sum += value >> 32;
+  }
+  parallel_for_total.fetch_add(sum, std::memory_order_relaxed);
+  return true;
+}
+
+template<size_t NumThreads>
+DEFINE_JOB(parallel_for_root) {
+  using pool_t = lofi::ThreadPool<NumThreads, ParallelForNumFibers>;
+  pool_t* thread_pool = (pool_t*)param;
+  auto begin = bench_clock_t::now();
+  thread_pool->get_host_worker()->parallel_for(0, ParallelForCount, 0, parallel_for_body, nullptr);
+  parallel_for_ms = elapsed_ms(begin);
+  return true;
+}
+
+template<size_t NumThreads>
+static void run_parallel_for() {
+  using pool_t = lofi::ThreadPool<NumThreads, ParallelForNumFibers>;
+  parallel_for_total.store(0, std::memory_order_relaxed);
+  run_root<pool_t>(parallel_for_root<NumThreads>);
+  PRINT("threads %2llu: %9.2f ms, checksum %llu\n", (u64)NumThreads, parallel_for_ms, parallel_for_total.load());
+}
+
+// a long chain of dependent jobs, submitted once from the main thread, no fiber ever waits
+template<size_t NumThreads>
+static void run_dependency_chain() {
+  using pool_t = lofi::ThreadPool<NumThreads, ChainNumFibers>;
+  using dependent_t = typename pool_t::dependent_job;
+  static dependent_t chain[ChainLength];
+  lofi::atomic_counter<> terminate_gate{0};
+  for(u64 i = 0; i < ChainLength; i++) {
+    lofi::Job job;
+    job.set_entry_point(fan_out_leaf);
+    job.set_may_wait(false);
+    job.set_job_start(i % FanOut);
+    job.set_job_end(i % FanOut + 1);
+    job.set_job_failure(bench_job_failure);
+    chain[i].job = job;
+    if(i) {
+      chain[i - 1].precede(&chain[i]);
+    }
+  }
+  chain[ChainLength - 1].job.set_job_success(bench_job_success);
+  chain[ChainLength - 1].job.set_job_counter(&terminate_gate);
+
+  auto begin = bench_clock_t::now();
+  GET_THREAD_POOL(pool_t)->submit(chain, ChainLength);
+  GET_THREAD_POOL(pool_t)->run();
+  while(terminate_gate.get_count() < 1) {
+    std::this_thread::yield();
+  }
+  const f64 ms = elapsed_ms(begin);
+  GET_THREAD_POOL(pool_t)->terminate();
+  PRINT("threads %2llu: %9.2f ms, %8.0f ns per link\n", (u64)NumThreads, ms, (ms * 1e6) / ChainLength);
+}
+
+// producers and consumers pairs hammering one queue, returns million items per second
+template<typename queue_t>
+static f64 run_queue_contention(queue_t* queue, const u64 pairs, const u64 batch) {
+  using node_t = typename queue_t::node;
+  static node_t nodes[QueueBenchItems];
+  const u64 per_producer = QueueBenchItems / pairs;
+  std::atomic<u64> consumed{0};
+  std::atomic<b8> go{false};
+  std::vector<std::thread> threads;
+
+  for(u64 i = 0; i < QueueBenchItems; i++) {
+    nodes[i].clear();
+    nodes[i].data = i;
+  }
+  for(u64 p = 0; p < pairs; p++) {
+    threads.emplace_back([&, p]() {
+      while(!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      const u64 first = p * per_producer;
+      for(u64 i = first; i < first + per_producer; i += batch) {
+        if(batch == 1) {
+          queue->push(p, &nodes[i]);
+          continue;
+        }
+        for(u64 j = i; j < i + batch - 1; j++) {
+          nodes[j].next = &nodes[j + 1];
+        }
+        queue->push(p, &nodes[i], &nodes[i + batch - 1], (u32)batch);
+      }
+    });
+    threads.emplace_back([&, p]() {
+      u64 items[QueueBenchBatch];
+      while(!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      while(consumed.load(std::memory_order_relaxed) < QueueBenchItems) {
+        const u32 count = batch == 1 ? (u32)queue->pop(p, items) : queue->pop(p, items, (u32)batch);
+        if(count) {
+          consumed.fetch_add(count, std::memory_order_relaxed);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  auto begin = bench_clock_t::now();
+  go.store(true, std::memory_order_release);
+  for(auto& thread : threads) {
+    thread.join();
+  }
+  return (f64)QueueBenchItems / (elapsed_ms(begin) * 1000.0);
+}
+
+static void run_queue_contention_pairs(const u64 batch) {
+  for(u64 pairs = 1; pairs <= QueueBenchThreads; pairs *= 2) {
+    const f64 list_rate = run_queue_contention(&list_queue, pairs, batch);
+    const f64 ring_rate = run_queue_contention(&ring_queue, pairs, batch);
+    PRINT("%2llu producers / %2llu consumers: guarded lists %8.2f Mitems/s, bounded ring %8.2f Mitems/s\n",
+        pairs, pairs, list_rate, ring_rate);
+  }
+}
+
+DEFINE_JOB(dispatch_pointer_job) {
+  dispatch_params* params = (dispatch_params*)param;
+  *params->sink = *params->sink + params->seed + start;
+  return true;
+}
+
+static lofi::Job make_pointer_job(u64 i) {
+  dispatch_params* params = &dispatch_param_slots[i % DispatchFanOut];
+  params->seed = i;
+  params->sink = &dispatch_sink;
+  lofi::Job job;
+  job.set_entry_point(dispatch_pointer_job);
+  job.set_obj((void*)params);
+  job.set_job_start(i);
+  job.set_job_end(i + 1);
+  return job;
+}
+
+static lofi::Job make_inline_job(u64 i) {
+  volatile u64* sink = &dispatch_sink;
+  lofi::Job job;
+  job.set_closure([sink, i]() { *sink = *sink + i + i; });
+  return job;
+}
+
+static lofi::Job make_boxed_job(u64 i) {
+  dispatch_payload payload;
+  for(u64 j = 0; j < 8; j++) {
+    payload.words[j] = i + j;
+  }
+  volatile u64* sink = &dispatch_sink;
+  lofi::Job job;
+  job.set_closure([sink, payload]() { *sink = *sink + payload.words[0] + payload.words[7]; });
+  return job;
+}
+
+// build, copy through a queue node's worth of bytes, run. no scheduler involved
+template<typename make_t>
+static f64 time_direct_dispatch(make_t make) {
+  lofi::Job slot;
+  auto begin = bench_clock_t::now();
+  for(u64 i = 0; i < DispatchJobs; i++) {
+    lofi::Job job = make(i);
+    MEM_COPY(&slot, &job, sizeof(lofi::Job));
+    lofi::Job to_run;
+    MEM_COPY(&to_run, &slot, sizeof(lofi::Job));
+    to_run.run();
+  }
+  return (elapsed_ms(begin) * 1e6) / DispatchJobs;
+}
+
+template<typename pool_t, typename make_t>
+static f64 time_scheduled_dispatch(pool_t* thread_pool, make_t make) {
+  lofi::atomic_counter<> counter{0};
+  lofi::Job jobs[DispatchFanOut];
+  auto begin = bench_clock_t::now();
+  for(u64 round = 0; round < DispatchRounds; round++) {
+    for(u64 i = 0; i < DispatchFanOut; i++) {
+      jobs[i] = make(round * DispatchFanOut + i);
+      jobs[i].set_may_wait(false);
+      jobs[i].set_job_counter(&counter);
+      jobs[i].set_job_success(lofi::job::count_success);
+    }
+    thread_pool->get_host_worker()->kick_high_priority_jobs(jobs, DispatchFanOut);
+    thread_pool->get_host_worker()->fiber_wait(&counter, DispatchFanOut * (round + 1));
+  }
+  return (elapsed_ms(begin) * 1e6) / (DispatchRounds * DispatchFanOut);
+}
+
+template<size_t NumThreads>
+DEFINE_JOB(dispatch_root) {
+  using pool_t = lofi::ThreadPool<NumThreads, DispatchNumFibers>;
+  pool_t* thread_pool = (pool_t*)param;
+  dispatch_scheduled_ns[0] = time_scheduled_dispatch(thread_pool, make_pointer_job);
+  dispatch_scheduled_ns[1] = time_scheduled_dispatch(thread_pool, make_inline_job);
+  dispatch_scheduled_ns[2] = time_scheduled_dispatch(thread_pool, make_boxed_job);
+  return true;
+}
+
+template<size_t NumThreads>
+static void run_dispatch() {
+  using pool_t = lofi::ThreadPool<NumThreads, DispatchNumFibers>;
+  PRINT("direct:    pointer + params %6.2f ns, inline closure %6.2f ns, boxed closure %6.2f ns\n",
+      time_direct_dispatch(make_pointer_job), time_direct_dispatch(make_inline_job), time_direct_dispatch(make_boxed_job));
+  run_root<pool_t>(dispatch_root<NumThreads>);
+  PRINT("scheduled: pointer + params %6.2f ns, inline closure %6.2f ns, boxed closure %6.2f ns (threads %llu)\n",
+      dispatch_scheduled_ns[0], dispatch_scheduled_ns[1], dispatch_scheduled_ns[2], (u64)NumThreads);
+}
+
+#if LOFI_FIBER_SYSV_ASM
+static lofi::fiber::context swap_host_context;
+static lofi::fiber::context swap_fiber_context;
+alignas(16) static u8 swap_stack[1 << 16];
+
+static void swap_ping(void*) {
+  for(;;) {
+    lofi::fiber::swap_context_sysv(&swap_fiber_context, &swap_host_context);
+  }
+}
+
+// layout the windows byte code switch expects, it saves rdi, rsi and xmm6-15 on top
+struct alignas(16) full_context {
+  void* rip = nullptr;
+  void* rsp = nullptr;
+  void* gprs[8] = {};
+  __m128i xmm[10] = {};
+  void* arg = nullptr;
+};
+static_assert(offsetof(full_context, arg) == 0xf0, "full_context does not match swap_context_w_code");
+
+// the byte code keeps the windows calling convention, ms_abi lets it run here unchanged
+using full_swap_t = void (__attribute__((ms_abi)) *)(full_context*, full_context*);
+
+static full_context full_host_context;
+static full_context full_fiber_context;
+
+__attribute__((ms_abi)) static void full_ping(void*) {
+  for(;;) {
+    ((full_swap_t)(void*)lofi::fiber::swap_context_w_code)(&full_fiber_context, &full_host_context);
+  }
+}
+
+// host and one fiber bouncing back and forth, returns ns per single switch
+template<typename swap_t>
+static f64 time_swaps(swap_t swap) {
+  for(u64 i = 0; i < SwapRounds / 16; i++) {
+    swap();
+  }
+  auto begin = bench_clock_t::now();
+  for(u64 i = 0; i < SwapRounds; i++) {
+    swap();
+  }
+  return (elapsed_ms(begin) * 1e6) / (f64)(SwapRounds * 2);
+}
+
+static void run_context_switch() {
+  u8* top = (u8*)lofi::fiber::do_align<sizeof(swap_stack)>(swap_stack) - 128;
+  lofi::fiber::create_fiber_context(swap_ping, nullptr, swap_stack, sizeof(swap_stack), &swap_fiber_context);
+  const f64 sysv_ns = time_swaps([]() { lofi::fiber::swap_context_sysv(&swap_host_context, &swap_fiber_context); });
+
+  full_fiber_context.rip = (void*)full_ping;
+  full_fiber_context.rsp = top - 8;
+  const f64 full_ns = time_swaps([]() { ((full_swap_t)(void*)lofi::fiber::swap_context_w_code)(&full_host_context, &full_fiber_context); });
+
+  PRINT("sysv asm, callee saved + mxcsr + x87 cw: %6.2f ns per swap\n", sysv_ns);
+  PRINT("byte code, full windows register set:    %6.2f ns per swap\n", full_ns);
+}
+#endif
+
+// fills every bucket of the set, then times finding the owner of each block, the old way by
+// asking each bucket in turn and through the bucket map, and the real free on top
+template<size_t ID>
+static void run_free_lookup() {
+  using allocator_t = lofi::LockFreeRuntimeAllocator<ID>;
+  using info_t = lofi::mem::bucket_info<ID>;
+  using map_t = lofi::mem::bucket_map<ID, false>;
+  static_assert(lofi::index_array<typename info_t::apply_block_count_seq::type>[0] == FreeLookupBlocks);
+  constexpr auto sizes = lofi::index_array<typename info_t::apply_block_size_seq::type>;
+  constexpr u64 count = info_t::bucket_count;
+
+  // blocks interleaved across buckets, so the scan ends at a different bucket every time
+  std::vector<void*> blocks;
+  blocks.reserve(count * FreeLookupBlocks);
+  for(u64 i = 0; i < count * FreeLookupBlocks; i++) {
+    if(void* block = allocator_t::allocate(sizes[i % count])) {
+      blocks.push_back(block);
+    }
+  }
+
+  void* probe = nullptr;
+  lofi::dispatcher belongs{ lofi::IdxV<count>
+                          , [&]<size_t Index>(lofi::IdxT<Index>){
+                            return lofi::mem::get_lock_free_pool<ID>().template get<Index>().belongs(probe);
+                          }};
+  u64 sum = 0;
+  auto begin = bench_clock_t::now();
+  for(u64 round = 0; round < FreeLookupRounds; round++) {
+    for(void* block : blocks) {
+      probe = block;
+      for(u64 i = 0; i < count; i++) {
+        if(belongs(i)) {
+          sum += i;
+          break;
+        }
+      }
+    }
+  }
+  const f64 scan_ns = (elapsed_ms(begin) * 1e6) / (f64)(FreeLookupRounds * blocks.size());
+
+  const u64 base = PTR2INT(lofi::mem::get_lock_free_pool<ID>().get_base());
+  u64 mapped_sum = 0;
+  begin = bench_clock_t::now();
+  for(u64 round = 0; round < FreeLookupRounds; round++) {
+    for(void* block : blocks) {
+      mapped_sum += map_t::find(PTR2INT(block) - base);
+    }
+  }
+  const f64 map_ns = (elapsed_ms(begin) * 1e6) / (f64)(FreeLookupRounds * blocks.size());
+  free_lookup_sink = free_lookup_sink + sum + mapped_sum;
+  L_ASSERT(sum == mapped_sum);
+
+  u64 freed = 0;
+  begin = bench_clock_t::now();
+  for(void* block : blocks) {
+    freed += allocator_t::free(block);
+  }
+  const f64 free_ns = (elapsed_ms(begin) * 1e6) / (f64)blocks.size();
+  L_ASSERT(freed == blocks.size());
+
+  PRINT("buckets %2llu: scan %6.2f ns, map %6.2f ns, free %6.2f ns (granule %llu bytes, table %llu bytes)\n",
+      count, scan_ns, map_ns, free_ns, 1ull << map_t::granule_shift, (u64)sizeof(map_t::table));
+}
+
+// every thread holds ScalingLive blocks of mixed sizes at a time, freed in the order they
+// were allocated
+template<typename allocator_t>
+static void scaling_work() {
+  void* live[ScalingLive];
+  u64 failures = 0;
+  for(u64 round = 0; round < ScalingRounds; round++) {
+    for(u64 i = 0; i < ScalingLive; i++) {
+      live[i] = allocator_t::allocate(scaling_sizes[(round + i) & 3]);
+    }
+    for(u64 i = 0; i < ScalingLive; i++) {
+      failures += !live[i] || !allocator_t::free(live[i]);
+    }
+  }
+  scaling_failures.fetch_add(failures, std::memory_order_relaxed);
+}
+
+// million allocate + free pairs per second over all threads
+template<typename work_t>
+static f64 run_scaling(const u64 num_threads, work_t work) {
+  std::atomic<b8> go{false};
+  std::vector<std::thread> threads;
+  for(u64 t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      while(!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      work(t);
+    });
+  }
+  auto begin = bench_clock_t::now();
+  go.store(true, std::memory_order_release);
+  for(auto& thread : threads) {
+    thread.join();
+  }
+  const f64 ms = elapsed_ms(begin);
+  return (f64)(num_threads * ScalingRounds * ScalingLive) / (ms * 1000.0);
+}
+
+static void run_allocator_scaling() {
+  for(u64 num_threads = 1; num_threads <= ScalingMaxThreads; num_threads *= 2) {
+    const f64 lock_free_rate = run_scaling(num_threads, [](u64) {
+      scaling_work<lofi::LockFreeRuntimeAllocator<ScalingSharedID>>();
+    });
+    const f64 magazine_rate = run_scaling(num_threads, [](u64) {
+      scaling_work<lofi::MagazineAllocator<ScalingSharedID>>();
+    });
+    const f64 per_thread_rate = run_scaling(num_threads, [](u64 t) {
+      lofi::dispatcher _dispatcher{ lofi::IdxV<ScalingMaxThreads>
+                                  , []<size_t Index>(lofi::IdxT<Index>){
+                                    scaling_work<lofi::RuntimeAllocator<ScalingPerThreadID + Index>>();
+                                    return true;
+                                  }};
+      _dispatcher(t);
+    });
+    PRINT("threads %llu: lock free %8.2f M/s, magazines %8.2f M/s, per thread %8.2f M/s\n",
+        num_threads, lock_free_rate, magazine_rate, per_thread_rate);
+  }
+  L_ASSERT(scaling_failures.load() == 0);
+}
+
+template<size_t NumThreads>
+static f64 run_fan_out(f64 baseline_rate) {
+  using pool_t = lofi::ThreadPool<NumThreads, BenchNumFibers>;
+  fan_out_tally = trace_tally{};
+  const f64 ms = run_root<pool_t>(fan_out_root<NumThreads>);
+
+  const f64 rate = (f64)(FanOut * FanOutRounds) / (ms / 1000.0);
+  PRINT("threads %2llu (workers %2llu): %9.2f ms, %12.0f jobs/s, scaling %5.2fx\n",
+      (u64)NumThreads, (u64)GET_THREAD_POOL(pool_t)->get_num_workers(), ms, rate,
+      baseline_rate > 0.0 ? rate / baseline_rate : 1.0);
+  const lofi::idle_stats stats = GET_THREAD_POOL(pool_t)->get_idle_stats();
+  PRINT("    idle: %llu spin hits, %llu parks, %llu wakes, %llu timeouts, %llu wake requests\n",
+      stats.spin_hits, stats.parks, stats.wakes, stats.timeouts, stats.wake_requests);
+  trace_tally& tally = fan_out_tally;
+  GET_THREAD_POOL(pool_t)->drain_trace(tally);
+  const u64 dropped = GET_THREAD_POOL(pool_t)->get_dropped_trace_events();
+  PRINT("    trace: %llu jobs, %llu swaps, %llu waits, %llu steals, %llu parks, %llu dropped\n",
+      tally.get(lofi::trace::Event::JobBegin), tally.get(lofi::trace::Event::FiberSwap),
+      tally.get(lofi::trace::Event::Wait), tally.get(lofi::trace::Event::Steal),
+      tally.get(lofi::trace::Event::ParkBegin), dropped);
+  if(dropped) {
+    PRINT_S("    warning: the trace rings overflowed between drains, the counts above are short\n");
+  }
+  return rate;
+}
+
+int main(int argc, char** argv) {
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("FAN OUT / FAN IN");
+//--------------------------------------------------------------------------------------------
+
+  PRINT("%llu rounds of %llu leaf jobs, %llu iterations each\n", FanOutRounds, FanOut, LeafWork);
+  const f64 baseline = run_fan_out<1>(0.0);
+  run_fan_out<2>(baseline);
+  run_fan_out<4>(baseline);
+  run_fan_out<8>(baseline);
+  run_fan_out<16>(baseline);
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("WAKE LATENCY");
+//--------------------------------------------------------------------------------------------
+
+  PRINT("last job finishing -> waiting fiber resumed, %llu rounds of %llu jobs\n", LatencyRounds, LatencyFanOut);
+  run_wake_latency<1>();
+  run_wake_latency<4>();
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("PARALLEL FOR");
+//--------------------------------------------------------------------------------------------
+
+  PRINT("%llu iterations, adaptive grain, one submission\n", ParallelForCount);
+  run_parallel_for<1>();
+  run_parallel_for<4>();
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("DEPENDENCY CHAIN");
+//--------------------------------------------------------------------------------------------
+
+  PRINT("%llu jobs, each released by its predecessor\n", ChainLength);
+  run_dependency_chain<4>();
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("JOB DISPATCH");
+//--------------------------------------------------------------------------------------------
+
+  PRINT("per job cost, sizeof(Job) = %llu, inline capture %llu bytes\n", (u64)sizeof(lofi::Job), (u64)LOFI_JOB_INLINE_CAPTURE);
+  run_dispatch<4>();
+
+#if LOFI_FIBER_SYSV_ASM
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("CONTEXT SWITCH");
+//--------------------------------------------------------------------------------------------
+
+  PRINT("%llu round trips between the host and one fiber\n", SwapRounds);
+  run_context_switch();
+
+#endif
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("FREE LOOKUP");
+//--------------------------------------------------------------------------------------------
+
+  PRINT("owning bucket of %llu blocks per bucket, %llu rounds\n", FreeLookupBlocks, FreeLookupRounds);
+  run_free_lookup<5>();
+  run_free_lookup<6>();
+  run_free_lookup<7>();
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("ALLOCATOR SCALING");
+//--------------------------------------------------------------------------------------------
+
+  PRINT("allocate + free pairs, %llu blocks held per thread, magazines of %llu\n", ScalingLive, (u64)LOFI_MAGAZINE_SIZE);
+  run_allocator_scaling();
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("QUEUE CONTENTION");
+//--------------------------------------------------------------------------------------------
+
+  PRINT("%llu items, single push and pop\n", QueueBenchItems);
+  run_queue_contention_pairs(1);
+  PRINT("%llu items, batches of %llu\n", QueueBenchItems, QueueBenchBatch);
+  run_queue_contention_pairs(QueueBenchBatch);
+
+  return 0;
+}
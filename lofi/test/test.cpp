@@ -13,6 +13,7 @@
 //   Organization:  Roxi Psychotronics
 //
 // =====================================================================================
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <stdio.h>
@@ -23,10 +24,48 @@
 #include "../core/include/l_variant.hpp"
 #include "../core/include/l_memory.hpp"
 #include "../core/include/l_thread_pool.hpp"
+#include "../core/include/l_fiber_sync.hpp"
+#include "../core/include/l_task.hpp"
+#include "../core/include/l_async_file.hpp"
+#include "../core/include/l_arena.hpp"
+#include "../core/include/l_frame_arena.hpp"
 #include "../core/include/l_database.hpp"
 #include "../core/include/l_map.hpp"
 #include "../core/include/ecs/l_ecs.hpp"
 
+// per thread pools for the cross thread free test, 64 blocks of 32 bytes each
+namespace lofi {
+  namespace mem {
+    using per_thread_test_set_t = List<BucketDescriptor<32, 64, 16>>;
+
+    template<>
+      struct BucketDescriptorSet<20> {
+        using type = per_thread_test_set_t;
+      };
+
+    template<>
+      struct BucketDescriptorSet<21> {
+        using type = per_thread_test_set_t;
+      };
+
+    template<>
+      struct BucketDescriptorSet<22> {
+        using type = per_thread_test_set_t;
+      };
+
+    template<>
+      struct BucketDescriptorSet<23> {
+        using type = per_thread_test_set_t;
+      };
+
+    // magazines of 16 blocks, so 32 threads can cache the whole small bucket between them
+    template<>
+      struct BucketDescriptorSet<24> {
+        using type = List<BucketDescriptor<32, 256, 16>, BucketDescriptor<64, 256, 16>>;
+      };
+  }		// -----  end of namespace mem  ----- 
+}		// -----  end of namespace lofi  ----- 
+
 
 //#define DO_BIG
 static constexpr u64 NumThreads = 4;
@@ -185,6 +224,524 @@ DEFINE_JOB(big_init_job) {
   return true;
 }
 
+static constexpr u64 PriorityNumThreads = 2;
+static constexpr u64 PriorityNumFibers = 32;
+static constexpr u64 FrameJobs = 40;
+static constexpr u64 StreamingJobs = 16;
+
+static std::atomic<u64> finish_sequence{0};
+static u64 frame_finished[FrameJobs];
+static u64 streaming_finished[StreamingJobs];
+static u64 late_finished = 0;
+
+// more late jobs than a worker has job nodes, each spawner kicks its share from its own worker
+static constexpr u64 LateSpawners = PriorityNumThreads;
+static constexpr u64 LateJobsPerSpawner = 56;
+static lofi::atomic_counter<> late_flood_done{0};
+
+static u64 spin_work(u64 seed) {
+  for(u64 i = 0; i < 4096; i++) {
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+  }
+  return seed;
+}
+
+DEFINE_JOB(frame_job) {
+  values[start] = spin_work(start);
+  frame_finished[start] = finish_sequence.fetch_add(1);
+  return true;
+}
+
+DEFINE_JOB(streaming_job) {
+  values[FrameJobs + start] = spin_work(start);
+  streaming_finished[start] = finish_sequence.fetch_add(1);
+  return true;
+}
+
+DEFINE_JOB(late_job) {
+  late_finished = finish_sequence.fetch_add(1);
+  return true;
+}
+
+DEFINE_JOB(late_flood_job) {
+  return true;
+}
+
+// kicks a batch of jobs that are late already from the worker it is pinned to, start is the
+// current frame
+DEFINE_JOB(late_spawner_job) {
+  using pool_t = lofi::ThreadPool<PriorityNumThreads, PriorityNumFibers>;
+  lofi::Job late[LateJobsPerSpawner];
+  for(u64 i = 0; i < LateJobsPerSpawner; i++) {
+    late[i].set_entry_point(late_flood_job);
+    late[i].set_may_wait(false);
+    late[i].set_deadline_frame(start - 1);
+    late[i].set_job_counter(&late_flood_done);
+    late[i].set_job_success(standard_job_success);
+  }
+  GET_HOST_WORKER(pool_t)->kick_high_priority_jobs(late, LateJobsPerSpawner);
+  return true;
+}
+
+// streaming work is queued first, then a late mid priority job and a frame worth of high
+// priority jobs, all from the same worker. after that a flood of late jobs
+DEFINE_JOB(priority_root_job) {
+  using pool_t = lofi::ThreadPool<PriorityNumThreads, PriorityNumFibers>;
+  pool_t* thread_pool = (pool_t*)param;
+  lofi::atomic_counter<> counter{0};
+  const u64 frame = thread_pool->begin_frame();
+
+  lofi::Job streaming[StreamingJobs];
+  for(u64 i = 0; i < StreamingJobs; i++) {
+    streaming[i].set_entry_point(streaming_job);
+    streaming[i].set_may_wait(false);
+    streaming[i].set_job_start(i);
+    streaming[i].set_job_end(i + 1);
+    streaming[i].set_job_counter(&counter);
+    streaming[i].set_job_success(standard_job_success);
+  }
+  thread_pool->get_host_worker()->kick_low_priority_jobs(streaming, StreamingJobs);
+
+  lofi::Job late;
+  late.set_entry_point(late_job);
+  late.set_may_wait(false);
+  late.set_deadline_frame(frame - 1);
+  late.set_job_counter(&counter);
+  late.set_job_success(standard_job_success);
+  thread_pool->get_host_worker()->kick_mid_priority_job(late);
+
+  lofi::Job frame_jobs[FrameJobs];
+  for(u64 i = 0; i < FrameJobs; i++) {
+    frame_jobs[i].set_entry_point(frame_job);
+    frame_jobs[i].set_may_wait(false);
+    frame_jobs[i].set_deadline_frame(frame);
+    frame_jobs[i].set_job_start(i);
+    frame_jobs[i].set_job_end(i + 1);
+    frame_jobs[i].set_job_counter(&counter);
+    frame_jobs[i].set_job_success(standard_job_success);
+  }
+  thread_pool->get_host_worker()->kick_high_priority_jobs(frame_jobs, FrameJobs);
+  thread_pool->get_host_worker()->fiber_wait(&counter, FrameJobs + StreamingJobs + 1);
+
+  L_ASSERT(thread_pool->get_num_workers() == LateSpawners && "late flood needs every worker");
+  for(u64 i = 0; i < LateSpawners; i++) {
+    lofi::Job spawner;
+    spawner.set_entry_point(late_spawner_job);
+    spawner.set_may_wait(false);
+    spawner.set_job_start(frame);
+    thread_pool->get_host_worker()->kick_pinned_job(i, spawner);
+  }
+  thread_pool->wait_for(&late_flood_done, LateSpawners * LateJobsPerSpawner);
+  return true;
+}
+
+static constexpr u64 SyncNumThreads = 4;
+static constexpr u64 SyncNumFibers = 64;
+static constexpr u64 SyncJobs = 16;
+static constexpr u64 SyncIncrements = 256;
+
+using sync_pool_t = lofi::ThreadPool<SyncNumThreads, SyncNumFibers>;
+
+static lofi::fiber_mutex<sync_pool_t> sync_mutex;
+static lofi::fiber_semaphore<sync_pool_t> sync_semaphore{2};
+static lofi::fiber_condition_variable<sync_pool_t> sync_condition;
+static u64 sync_total = 0;                  // only touched under sync_mutex
+static u64 sync_finished = 0;
+static std::atomic<u64> sync_in_flight{0};
+static std::atomic<u64> sync_max_in_flight{0};
+static lofi::fiber_local<u64> sync_local;
+static u64 sync_local_values[SyncJobs];
+static std::atomic<u64> sync_local_mixed{0};
+static std::atomic<u64> sync_local_inline_seen{0};
+
+// jobs that may not wait have no fiber of their own, so no fiber locals either
+DEFINE_JOB(sync_inline_job) {
+  if(sync_local.get() || sync_local.set(&sync_local_values[0])) {
+    sync_local_inline_seen++;
+  }
+  return true;
+}
+
+DEFINE_JOB(sync_job) {
+  // every job waits below, so other jobs run on the same worker before it checks its value
+  sync_local_values[start] = start;
+  sync_local.set(&sync_local_values[start]);
+  for(u64 i = 0; i < SyncIncrements; i++) {
+    sync_mutex.lock();
+    sync_total++;
+    sync_mutex.unlock();
+  }
+
+  sync_semaphore.acquire();
+  const u64 in_flight = sync_in_flight.fetch_add(1) + 1;
+  u64 seen = sync_max_in_flight.load();
+  while(in_flight > seen && !sync_max_in_flight.compare_exchange_weak(seen, in_flight)) {}
+  values[start] = spin_work(start);
+  sync_in_flight.fetch_sub(1);
+  sync_semaphore.release();
+
+  sync_mutex.lock();
+  sync_finished++;
+  sync_condition.notify_all();
+  sync_mutex.unlock();
+
+  if(sync_local.get() != &sync_local_values[start]) {
+    sync_local_mixed++;
+  }
+  return true;
+}
+
+// waits on the condition variable for every job, then on the counter for their successes
+DEFINE_JOB(sync_root_job) {
+  sync_pool_t* thread_pool = (sync_pool_t*)param;
+  lofi::atomic_counter<> counter{0};
+  lofi::Job jobs[SyncJobs];
+  for(u64 i = 0; i < SyncJobs; i++) {
+    jobs[i].set_entry_point(sync_job);
+    jobs[i].set_job_start(i);
+    jobs[i].set_job_end(i + 1);
+    jobs[i].set_job_counter(&counter);
+    jobs[i].set_job_success(standard_job_success);
+  }
+  thread_pool->get_host_worker()->kick_high_priority_jobs(jobs, SyncJobs);
+
+  lofi::Job inline_job;
+  inline_job.set_entry_point(sync_inline_job);
+  inline_job.set_may_wait(false);
+  inline_job.set_job_counter(&counter);
+  inline_job.set_job_success(standard_job_success);
+  thread_pool->get_host_worker()->kick_high_priority_job(inline_job);
+
+  sync_mutex.lock();
+  sync_condition.wait(sync_mutex, []() { return sync_finished == SyncJobs; });
+  sync_mutex.unlock();
+  thread_pool->get_host_worker()->fiber_wait(&counter, SyncJobs + 1);
+  return true;
+}
+
+static constexpr u64 PinnedNumThreads = 4;
+static constexpr u64 PinnedNumFibers = 48;
+static constexpr u64 PinnedJobsPerWorker = 4;
+static constexpr u64 PinnedJobs = PinnedNumThreads * PinnedJobsPerWorker;
+
+using pinned_pool_t = lofi::ThreadPool<PinnedNumThreads, PinnedNumFibers>;
+
+static u64 pinned_ran_on[PinnedJobs];
+static u64 pinned_resumed_on[PinnedJobs];
+
+DEFINE_JOB(pinned_child_job) {
+  values[start] = spin_work(start);
+  return true;
+}
+
+// waits on shared work in the middle, the fiber has to come back on the same worker
+DEFINE_JOB(pinned_job) {
+  pinned_pool_t* thread_pool = (pinned_pool_t*)param;
+  pinned_ran_on[start] = thread_pool->get_host_worker()->get_thread_id();
+  lofi::atomic_counter<> counter{0};
+  lofi::Job child;
+  child.set_entry_point(pinned_child_job);
+  child.set_may_wait(false);
+  child.set_job_start(start);
+  child.set_job_end(start + 1);
+  child.set_job_counter(&counter);
+  child.set_job_success(standard_job_success);
+  thread_pool->get_host_worker()->kick_high_priority_job(child);
+  thread_pool->get_host_worker()->fiber_wait(&counter, 1);
+  pinned_resumed_on[start] = thread_pool->get_host_worker()->get_thread_id();
+  return true;
+}
+
+DEFINE_JOB(pinned_root_job) {
+  pinned_pool_t* thread_pool = (pinned_pool_t*)param;
+  lofi::atomic_counter<> counter{0};
+  lofi::Job jobs[PinnedJobs];
+  for(u64 i = 0; i < PinnedJobs; i++) {
+    jobs[i].set_entry_point(pinned_job);
+    jobs[i].set_job_start(i);
+    jobs[i].set_job_end(i + 1);
+    jobs[i].set_job_counter(&counter);
+    jobs[i].set_job_success(standard_job_success);
+  }
+  for(u64 worker = 0; worker < PinnedNumThreads; worker++) {
+    thread_pool->get_host_worker()->kick_pinned_jobs(worker, &jobs[worker * PinnedJobsPerWorker], PinnedJobsPerWorker);
+  }
+  thread_pool->get_host_worker()->fiber_wait(&counter, PinnedJobs);
+  return true;
+}
+
+static constexpr u64 ResizeNumThreads = 4;
+static constexpr u64 ResizeNumFibers = 40;
+static constexpr u64 ResizeRounds = 64;
+static constexpr u64 ResizeJobsPerRound = 32;
+
+using resize_pool_t = lofi::ThreadPool<ResizeNumThreads, ResizeNumFibers>;
+
+static std::atomic<u64> resize_jobs_run{0};
+static u64 resize_max_workers = 0;
+
+DEFINE_JOB(resize_job) {
+  values[start] = spin_work(start);
+  resize_jobs_run.fetch_add(1);
+  return true;
+}
+
+// keeps the pool busy round after round while the main thread adds and retires workers
+DEFINE_JOB(resize_root_job) {
+  resize_pool_t* thread_pool = (resize_pool_t*)param;
+  for(u64 round = 0; round < ResizeRounds; round++) {
+    lofi::atomic_counter<> counter{0};
+    lofi::Job jobs[ResizeJobsPerRound];
+    for(u64 i = 0; i < ResizeJobsPerRound; i++) {
+      jobs[i].set_entry_point(resize_job);
+      jobs[i].set_may_wait(false);
+      jobs[i].set_job_start(i);
+      jobs[i].set_job_end(i + 1);
+      jobs[i].set_job_counter(&counter);
+      jobs[i].set_job_success(standard_job_success);
+    }
+    thread_pool->get_host_worker()->kick_high_priority_jobs(jobs, ResizeJobsPerRound);
+    thread_pool->get_host_worker()->fiber_wait(&counter, ResizeJobsPerRound);
+    resize_max_workers = MAX(resize_max_workers, (u64)thread_pool->get_num_workers());
+  }
+  return true;
+}
+
+static constexpr u64 TimerNumThreads = 2;
+static constexpr u64 TimerNumFibers = 24;
+static constexpr u64 TimerDelayNs = 2000000;
+static constexpr u64 TimerPeriodNs = 1000000;
+static constexpr u64 TimerTimeoutNs = 3000000;
+
+using timer_pool_t = lofi::ThreadPool<TimerNumThreads, TimerNumFibers>;
+
+static std::atomic<u64> timer_ticks{0};
+static u64 timer_delayed_late_ns = 0;
+static b8 timer_timed_out = false;
+static u64 timer_timeout_waited_ns = 0;
+static b8 timer_reached = false;
+static b8 timer_cancelled = false;
+
+DEFINE_JOB(timer_tick_job) {
+  timer_ticks.fetch_add(1);
+  return true;
+}
+
+DEFINE_JOB(timer_root_job) {
+  timer_pool_t* thread_pool = (timer_pool_t*)param;
+  lofi::atomic_counter<> delayed_done{0};
+  const u64 kicked_at = lofi::timer::now_ns();
+  timer_pool_t::timed_job delayed;
+  delayed.job.set_entry_point(timer_tick_job);
+  delayed.job.set_may_wait(false);
+  delayed.job.set_job_counter(&delayed_done);
+  delayed.job.set_job_success(standard_job_success);
+  thread_pool->kick_delayed(&delayed, TimerDelayNs);
+  thread_pool->wait_for(&delayed_done, 1);
+  timer_delayed_late_ns = lofi::timer::now_ns() - kicked_at - TimerDelayNs;
+  // the job ran, but the kick that queued it may still be unwinding off the wheel
+  const b8 delayed_cancelled = thread_pool->cancel_timed(&delayed);
+
+  timer_pool_t::timed_job periodic;
+  periodic.job.set_entry_point(timer_tick_job);
+  periodic.job.set_may_wait(false);
+  thread_pool->kick_periodic(&periodic, TimerPeriodNs);
+  thread_pool->sleep_for(TimerPeriodNs * 20);
+  timer_cancelled = thread_pool->cancel_timed(&periodic) && !delayed_cancelled;
+
+  lofi::atomic_counter<> never{0};
+  const u64 wait_began = lofi::timer::now_ns();
+  timer_timed_out = !thread_pool->wait_for(&never, 1, TimerTimeoutNs);
+  timer_timeout_waited_ns = lofi::timer::now_ns() - wait_began;
+
+  lofi::atomic_counter<> reached{0};
+  lofi::Job quick;
+  quick.set_entry_point(timer_tick_job);
+  quick.set_may_wait(false);
+  quick.set_job_counter(&reached);
+  quick.set_job_success(standard_job_success);
+  thread_pool->get_host_worker()->kick_high_priority_job(quick);
+  timer_reached = thread_pool->wait_for(&reached, 1, TimerTimeoutNs * 100);
+  return true;
+}
+
+static constexpr u64 TaskNumThreads = 4;
+static constexpr u64 TaskNumFibers = 8;
+static constexpr u64 TaskCount = 10000;
+
+using task_pool_t = lofi::ThreadPool<TaskNumThreads, TaskNumFibers>;
+
+static lofi::atomic_counter<> task_gate{0};
+static std::atomic<u64> task_job_sum{0};
+static std::atomic<u64> task_child_errors{0};
+
+DEFINE_JOB(task_add_job) {
+  task_job_sum.fetch_add(start);
+  return true;
+}
+
+static lofi::task<u64> task_double(u64 value) {
+  co_return value * 2;
+}
+
+static lofi::task<> task_body(u64 index) {
+  co_await lofi::wait<task_pool_t>(&task_gate, 1);
+  lofi::Job job;
+  job.set_entry_point(task_add_job);
+  job.set_may_wait(false);
+  job.set_job_start(index);
+  co_await lofi::kick<task_pool_t>(job);
+  if(co_await task_double(index) != index * 2) {
+    task_child_errors.fetch_add(1);
+  }
+}
+
+static constexpr u64 FileNumThreads = 2;
+static constexpr u64 FileNumFibers = 16;
+static constexpr u64 FileSize = KB(256) + 123;
+static constexpr u64 FileChunks = 16;
+static constexpr u64 FileChunkSize = FileSize / FileChunks;
+static constexpr const char* FilePath = "lofi_async_file_test.bin";
+
+using file_pool_t = lofi::ThreadPool<FileNumThreads, FileNumFibers>;
+using file_arena_t = lofi::Arena<FileChunks * FileChunkSize, 8, lofi::mem::MAllocPolicy>;
+
+static u8 file_byte(u64 offset) {
+  return (u8)((offset * 31) ^ (offset >> 8));
+}
+
+static u64 file_mismatches[2] = {};
+static i64 file_tail_read[2] = {};
+static u32 file_batched[2] = {};
+static lofi::io::Backend file_backends[2] = {};
+
+// whole file through a parked fiber, then one batch of chunks into an arena and a read that
+// runs into the end of the file
+static void file_reads(file_pool_t* thread_pool, u32 pass) {
+  lofi::AsyncFile file = lofi::AsyncFile::open(FilePath);
+  file_backends[pass] = lofi::io::Service::instance()->get_backend();
+  u8* whole = (u8*)malloc(FileSize);
+  const i64 read = file.read(thread_pool, whole, FileSize, 0);
+  file_mismatches[pass] += read != (i64)FileSize || file.get_size() != FileSize;
+  for(u64 i = 0; i < FileSize && read == (i64)FileSize; i++) {
+    file_mismatches[pass] += whole[i] != file_byte(i);
+  }
+  free(whole);
+
+  file_arena_t arena;
+  lofi::atomic_counter<> chunks_done{0};
+  lofi::io::read_request chunks[FileChunks];
+  for(u64 i = 0; i < FileChunks; i++) {
+    chunks[i].size = FileChunkSize;
+    chunks[i].offset = (FileChunks - 1 - i) * FileChunkSize;
+  }
+  file_batched[pass] = file.read_batch(&arena, chunks, FileChunks, &chunks_done);
+  thread_pool->wait_for(&chunks_done, file_batched[pass]);
+  for(u64 i = 0; i < file_batched[pass]; i++) {
+    file_mismatches[pass] += chunks[i].result != (i64)FileChunkSize;
+    for(u64 j = 0; j < FileChunkSize; j++) {
+      file_mismatches[pass] += ((u8*)chunks[i].buffer)[j] != file_byte(chunks[i].offset + j);
+    }
+  }
+
+  u8 tail[256];
+  file_tail_read[pass] = file.read(thread_pool, tail, sizeof(tail), FileSize - 100);
+}
+
+DEFINE_JOB(file_root_job) {
+  file_pool_t* thread_pool = (file_pool_t*)param;
+  lofi::io::Service::instance()->start(lofi::io::Backend::Uring);
+  file_reads(thread_pool, 0);
+  lofi::io::Service::instance()->stop();
+  lofi::io::Service::instance()->start(lofi::io::Backend::Threads);
+  file_reads(thread_pool, 1);
+  lofi::io::Service::instance()->stop();
+  return true;
+}
+
+static constexpr u64 FrameArenaNumThreads = 4;
+static constexpr u64 FrameArenaNumFibers = 20;
+static constexpr u64 FrameSlots = 4;
+static constexpr u64 FramesRun = 3 * FrameSlots;
+static constexpr u64 FrameArenaJobs = 48;
+static constexpr u64 FrameWords = 16;
+static constexpr u64 FrameMainBlocks = 256;
+
+using frame_pool_t = lofi::ThreadPool<FrameArenaNumThreads, FrameArenaNumFibers>;
+using frame_arenas_t = lofi::FrameArenas<frame_pool_t, FrameSlots, FrameArenaNumThreads, KB(64)>;
+
+static frame_arenas_t frame_arenas;
+static u64 frame_current = 0;
+static u64* frame_blocks[FrameArenaJobs];
+static u64* frame_main_blocks[FrameMainBlocks];
+static std::atomic<b8> frame_main_done{false};
+static u64 frame_errors = 0;
+static u64 frame_unreset = 0;
+
+static void frame_fill(u64* block, const u64 tag) {
+  for(u64 i = 0; i < FrameWords; i++) {
+    block[i] = tag;
+  }
+}
+
+static b8 frame_intact(const u64* block, const u64 tag) {
+  if(!block || PTR2INT(block) & 63) {
+    return false;
+  }
+  for(u64 i = 0; i < FrameWords; i++) {
+    if(block[i] != tag) {
+      return false;
+    }
+  }
+  return true;
+}
+
+DEFINE_JOB(frame_fill_job) {
+  u64* block = (u64*)frame_arenas.allocate(frame_current, FrameWords * sizeof(u64), 64);
+  if(block) {
+    frame_fill(block, frame_current * FrameArenaJobs + start);
+  }
+  frame_blocks[start] = block;
+  return true;
+}
+
+// the main thread fills the first frame from outside the pool while the workers do, after
+// that every frame is checked and reset before its slot comes around again
+DEFINE_JOB(frame_root_job) {
+  frame_pool_t* thread_pool = (frame_pool_t*)param;
+  for(u64 frame = 0; frame < FramesRun; frame++) {
+    if(frame >= FrameSlots) {
+      frame_unreset += frame_arenas.get_size(frame) != 0;
+    }
+    frame_current = frame;
+    lofi::atomic_counter<> counter{0};
+    lofi::Job jobs[FrameArenaJobs];
+    for(u64 i = 0; i < FrameArenaJobs; i++) {
+      jobs[i].set_entry_point(frame_fill_job);
+      jobs[i].set_may_wait(false);
+      jobs[i].set_job_start(i);
+      jobs[i].set_job_end(i + 1);
+      jobs[i].set_job_counter(&counter);
+      jobs[i].set_job_success(standard_job_success);
+    }
+    thread_pool->get_host_worker()->kick_high_priority_jobs(jobs, FrameArenaJobs);
+    thread_pool->wait_for(&counter, FrameArenaJobs);
+    for(u64 i = 0; i < FrameArenaJobs; i++) {
+      frame_errors += !frame_intact(frame_blocks[i], frame * FrameArenaJobs + i);
+    }
+    if(!frame) {
+      while(!frame_main_done.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      for(u64 i = 0; i < FrameMainBlocks; i++) {
+        frame_errors += !frame_intact(frame_main_blocks[i], MAX_u64 - i);
+      }
+    }
+    frame_arenas.reset(frame);
+  }
+  return true;
+}
+
 using ExampleTableTuple = lofi::tuple<u64, u64, double>;
 using ExampleTableDescriptor = lofi::TableDescriptor<32, u64, u64, double>;
 using ExampleTable = lofi::Table< ExampleTableDescriptor
@@ -502,6 +1059,109 @@ int main(int argc, char** argv) {
     EVAL_PRINT_ULL(i);
   }
 
+  // every thread empties its pool, frees the next thread's blocks remotely, then empties its
+  // pool again, which only works if the remote frees were reclaimed
+  PRINT_S("Cross thread frees with the per thread allocator\n");
+  {
+    using per_thread_t = lofi::PerThreadAllocator<20, 4>;
+    static void* per_thread_blocks[4][64];
+    static u64 per_thread_counts[4][2];
+    std::atomic<u64> arrived{0};
+    std::vector<std::thread> threads;
+    for(u64 t = 0; t < 4; t++) {
+      threads.emplace_back([&, t]() {
+        for(u64 round = 0; round < 2; round++) {
+          u64 count = 0;
+          while(count < 64 && (per_thread_blocks[t][count] = per_thread_t::allocate(t, 32))) {
+            count++;
+          }
+          per_thread_counts[t][round] = count + (per_thread_t::allocate(t, 32) != nullptr);
+          if(round) {
+            break;
+          }
+          arrived++;
+          while(arrived.load() < 4) {
+            std::this_thread::yield();
+          }
+          const u64 next = (t + 1) & 3;
+          for(u64 i = 0; i < 64; i++) {
+            L_ASSERT(per_thread_t::find_owner(per_thread_blocks[next][i]) == next);
+            per_thread_t::free(t, per_thread_blocks[next][i]);
+          }
+          arrived++;
+          while(arrived.load() < 8) {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+    for(auto& thread : threads) {
+      thread.join();
+    }
+    for(u64 t = 0; t < 4; t++) {
+      PRINT("thread %llu: %llu blocks, %llu after remote frees\n", t, per_thread_counts[t][0], per_thread_counts[t][1]);
+      L_ASSERT(per_thread_counts[t][0] == 64 && per_thread_counts[t][1] == 64);
+    }
+  }
+
+  // every thread keeps its magazine of the small bucket alive, which drains the bucket, the
+  // main thread then has to be served from the larger one
+  PRINT_S("Magazines holding a whole bucket\n");
+  {
+    using magazine_t = lofi::MagazineAllocator<24>;
+    static constexpr u64 MagazineThreads = 32;
+    std::atomic<u64> holding{0};
+    std::atomic<b8> release{false};
+    std::vector<std::thread> threads;
+    for(u64 t = 0; t < MagazineThreads; t++) {
+      threads.emplace_back([&]() {
+        void* block = magazine_t::allocate(32);
+        holding++;
+        while(!release.load()) {
+          std::this_thread::yield();
+        }
+        magazine_t::free(block);
+      });
+    }
+    while(holding.load() < MagazineThreads) {
+      std::this_thread::yield();
+    }
+    void* spilled = magazine_t::allocate(32);
+    release.store(true);
+    for(auto& thread : threads) {
+      thread.join();
+    }
+    PRINT("magazine capacity %llu, main thread got a block: %u\n", (u64)magazine_t::get_capacity(0), spilled != nullptr);
+    L_ASSERT(spilled && "allocation failed while larger blocks were free");
+    magazine_t::free(spilled);
+    magazine_t::flush_thread();
+  }
+
+  // reserves a gigabyte, commits only what was pushed and gives it back past the slack
+  PRINT_S("Virtual memory arena\n");
+  {
+    using vm_arena_t = lofi::Arena<GB(1), 64, lofi::mem::VirtualAllocPolicy>;
+    vm_arena_t vm_arena;
+    vm_arena.set_decommit_slack(MB(1));
+    const u64 untouched = vm_arena.get_committed();
+    u8* first = (u8*)vm_arena.push(MB(48));
+    u8* second = (u8*)vm_arena.push(MB(16));
+    L_ASSERT(first && second == first + MB(48));
+    memset(first, 0xab, MB(64));
+    const u64 grown = vm_arena.get_committed();
+    vm_arena.pop_to((const void*)second);
+    const u64 popped = vm_arena.get_committed();
+    vm_arena.clear();
+    const u64 cleared = vm_arena.get_committed();
+    u8* again = (u8*)vm_arena.push(KB(4));
+    const b8 reused = again == first;
+    const b8 too_big = vm_arena.push(GB(1)) == nullptr;
+    PRINT("committed: %llu untouched, %llu after 64MB, %llu after pop to 48MB, %llu after clear\n", untouched, grown, popped, cleared);
+    L_ASSERT(untouched == 0 && grown >= MB(64) && grown < MB(65));
+    L_ASSERT(popped <= MB(49) && cleared <= MB(1));
+    L_ASSERT(reused && too_big);
+  }
+
 ////--------------------------------------------------------------------------------------------
 //  PRINT_TITLE("SYNC");
 ////--------------------------------------------------------------------------------------------
@@ -591,6 +1251,348 @@ int main(int argc, char** argv) {
   }
 #endif
 
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("PRIORITIES");
+//--------------------------------------------------------------------------------------------
+
+  using priority_pool_t = lofi::ThreadPool<PriorityNumThreads, PriorityNumFibers>;
+
+  priority_pool_t::job_node_t priority_node{};
+  lofi::atomic_counter<> priority_gate{0};
+  lofi::Job priority_root;
+  priority_root.set_entry_point(priority_root_job);
+  priority_root.set_job_success(standard_job_success);
+  priority_root.set_job_failure(print_job_failure);
+  priority_root.set_job_start(0);
+  priority_root.set_job_end(1);
+  priority_root.set_job_counter(&priority_gate);
+  priority_node.data = priority_root;
+
+  // the late flood pins a spawner to every worker, they have to exist on small machines too
+  lofi::pool_config priority_config;
+  priority_config.workers = PriorityNumThreads;
+  GET_THREAD_POOL(priority_pool_t)->configure(priority_config);
+  GET_THREAD_POOL(priority_pool_t)->push_high_priority_job(0, &priority_node);
+  GET_THREAD_POOL(priority_pool_t)->run();
+  while(priority_gate.get_count() < 1) {
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(10ms);
+  }
+  GET_THREAD_POOL(priority_pool_t)->terminate();
+
+  u64 last_frame_finished = 0;
+  u64 frame_rank_total = 0;
+  for(size_t i = 0; i < FrameJobs; i++) {
+    last_frame_finished = MAX(last_frame_finished, frame_finished[i]);
+    frame_rank_total += frame_finished[i];
+  }
+  u64 streaming_rank_total = 0;
+  u64 streaming_during_frame = 0;
+  for(size_t i = 0; i < StreamingJobs; i++) {
+    streaming_rank_total += streaming_finished[i];
+    streaming_during_frame += streaming_finished[i] < last_frame_finished;
+  }
+  PRINT("frame jobs average finish rank = %llu, streaming jobs average finish rank = %llu\n",
+      frame_rank_total / FrameJobs, streaming_rank_total / StreamingJobs);
+  PRINT("streaming jobs finished while frame work was queued = %llu of %llu\n", streaming_during_frame, StreamingJobs);
+  PRINT("late job finish rank = %llu (demoted behind the frame)\n", late_finished);
+  L_ASSERT(frame_rank_total / FrameJobs < streaming_rank_total / StreamingJobs && "frame work should finish first");
+  L_ASSERT(streaming_during_frame > 0 && "low priority work starved");
+  PRINT("late flood: %llu of %llu late jobs ran\n", (u64)late_flood_done.get_count(), LateSpawners * LateJobsPerSpawner);
+  L_ASSERT(late_flood_done.get_count() == LateSpawners * LateJobsPerSpawner && "late jobs lost while demoting");
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("FIBER SYNC");
+//--------------------------------------------------------------------------------------------
+
+  sync_pool_t::job_node_t sync_node{};
+  lofi::atomic_counter<> sync_gate{0};
+  lofi::Job sync_root;
+  sync_root.set_entry_point(sync_root_job);
+  sync_root.set_job_success(standard_job_success);
+  sync_root.set_job_failure(print_job_failure);
+  sync_root.set_job_start(0);
+  sync_root.set_job_end(1);
+  sync_root.set_job_counter(&sync_gate);
+  sync_node.data = sync_root;
+
+  GET_THREAD_POOL(sync_pool_t)->push_high_priority_job(0, &sync_node);
+  GET_THREAD_POOL(sync_pool_t)->run();
+  while(sync_gate.get_count() < 1) {
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(10ms);
+  }
+  GET_THREAD_POOL(sync_pool_t)->terminate();
+
+  PRINT("mutex guarded total = %llu, expected %llu\n", sync_total, SyncJobs * SyncIncrements);
+  PRINT("semaphore max in flight = %llu, permits 2\n", sync_max_in_flight.load());
+  PRINT("condition variable saw %llu of %llu jobs finish\n", sync_finished, SyncJobs);
+  L_ASSERT(sync_total == SyncJobs * SyncIncrements && "fiber_mutex lost an increment");
+  L_ASSERT(sync_max_in_flight.load() <= 2 && "fiber_semaphore let too many through");
+
+  // slots of destroyed fiber locals are handed out again
+  for(u64 i = 0; i < LOFI_FIBER_LOCAL_SLOTS * 2; i++) {
+    lofi::fiber_local<u64> scoped_local;
+  }
+  PRINT("fiber locals mixed up in %llu of %llu jobs, seen by %llu inline jobs\n", sync_local_mixed.load(), SyncJobs, sync_local_inline_seen.load());
+  L_ASSERT(sync_local_mixed.load() == 0 && "a fiber saw another fiber's local");
+  L_ASSERT(sync_local_inline_seen.load() == 0 && "an inline job had fiber locals");
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("PINNED JOBS");
+//--------------------------------------------------------------------------------------------
+
+  pinned_pool_t::job_node_t pinned_node{};
+  lofi::atomic_counter<> pinned_gate{0};
+  lofi::Job pinned_root;
+  pinned_root.set_entry_point(pinned_root_job);
+  pinned_root.set_job_success(standard_job_success);
+  pinned_root.set_job_failure(print_job_failure);
+  pinned_root.set_job_start(0);
+  pinned_root.set_job_end(1);
+  pinned_root.set_job_counter(&pinned_gate);
+  pinned_node.data = pinned_root;
+
+  // every pinned worker has to exist before the root kicks to it, also on machines with fewer cores
+  lofi::pool_config pinned_config;
+  pinned_config.workers = PinnedNumThreads;
+  GET_THREAD_POOL(pinned_pool_t)->configure(pinned_config);
+  GET_THREAD_POOL(pinned_pool_t)->run();
+  GET_THREAD_POOL(pinned_pool_t)->push_high_priority_job(0, &pinned_node);
+  while(pinned_gate.get_count() < 1) {
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(10ms);
+  }
+  GET_THREAD_POOL(pinned_pool_t)->terminate();
+
+  u64 pinned_misplaced = 0;
+  for(size_t i = 0; i < PinnedJobs; i++) {
+    const u64 target = i / PinnedJobsPerWorker;
+    pinned_misplaced += pinned_ran_on[i] != target || pinned_resumed_on[i] != target;
+  }
+  PRINT("pinned jobs off their worker = %llu of %llu\n", pinned_misplaced, PinnedJobs);
+  L_ASSERT(pinned_misplaced == 0 && "pinned job ran or resumed on the wrong worker");
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("POOL RESIZING");
+//--------------------------------------------------------------------------------------------
+
+  resize_pool_t::job_node_t resize_node{};
+  lofi::atomic_counter<> resize_gate{0};
+  lofi::Job resize_root;
+  resize_root.set_entry_point(resize_root_job);
+  resize_root.set_job_success(standard_job_success);
+  resize_root.set_job_failure(print_job_failure);
+  resize_root.set_job_start(0);
+  resize_root.set_job_end(1);
+  resize_root.set_job_counter(&resize_gate);
+  resize_node.data = resize_root;
+
+  lofi::pool_config resize_config;
+  resize_config.workers = 1;
+  resize_config.fibers = 16;
+  GET_THREAD_POOL(resize_pool_t)->configure(resize_config);
+  GET_THREAD_POOL(resize_pool_t)->push_high_priority_job(0, &resize_node);
+  GET_THREAD_POOL(resize_pool_t)->run();
+  PRINT("started with %llu workers and %llu fibers\n", (u64)GET_THREAD_POOL(resize_pool_t)->get_num_workers(), GET_THREAD_POOL(resize_pool_t)->get_num_fibers());
+  const u32 added_first = GET_THREAD_POOL(resize_pool_t)->add_worker();
+  const u32 added_second = GET_THREAD_POOL(resize_pool_t)->add_worker();
+  const u32 added_third = GET_THREAD_POOL(resize_pool_t)->add_worker();
+  const u32 added_past_capacity = GET_THREAD_POOL(resize_pool_t)->add_worker();
+  {
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(5ms);
+  }
+  const b8 retired_first = GET_THREAD_POOL(resize_pool_t)->retire_worker();
+  const b8 retired_second = GET_THREAD_POOL(resize_pool_t)->retire_worker();
+  const b8 retired_third = GET_THREAD_POOL(resize_pool_t)->retire_worker();
+  const b8 retired_last = GET_THREAD_POOL(resize_pool_t)->retire_worker();
+  while(resize_gate.get_count() < 1) {
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(10ms);
+  }
+  GET_THREAD_POOL(resize_pool_t)->terminate();
+
+  PRINT("added workers %u, %u and %u, past capacity = %u\n", added_first, added_second, added_third, added_past_capacity);
+  PRINT("retired %u, %u, %u, last worker %u\n", retired_first, retired_second, retired_third, retired_last);
+  PRINT("jobs run = %llu of %llu, most workers seen = %llu\n", resize_jobs_run.load(), ResizeRounds * ResizeJobsPerRound, resize_max_workers);
+  L_ASSERT(added_first == 1 && added_second == 2 && added_third == 3 && added_past_capacity == MAX_u32 && "add_worker past capacity");
+  L_ASSERT(retired_first && retired_second && retired_third && !retired_last && "retire_worker has to keep one worker");
+  L_ASSERT(resize_jobs_run.load() == ResizeRounds * ResizeJobsPerRound && "jobs lost while resizing");
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("TIMERS");
+//--------------------------------------------------------------------------------------------
+
+  timer_pool_t::job_node_t timer_node{};
+  lofi::atomic_counter<> timer_gate{0};
+  lofi::Job timer_root;
+  timer_root.set_entry_point(timer_root_job);
+  timer_root.set_job_success(standard_job_success);
+  timer_root.set_job_failure(print_job_failure);
+  timer_root.set_job_start(0);
+  timer_root.set_job_end(1);
+  timer_root.set_job_counter(&timer_gate);
+  timer_node.data = timer_root;
+
+  GET_THREAD_POOL(timer_pool_t)->push_high_priority_job(0, &timer_node);
+  GET_THREAD_POOL(timer_pool_t)->run();
+  while(timer_gate.get_count() < 1) {
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(10ms);
+  }
+  GET_THREAD_POOL(timer_pool_t)->terminate();
+
+  PRINT("delayed job fired %llu us after its deadline\n", timer_delayed_late_ns / 1000);
+  PRINT("periodic job ticked %llu times in %llu periods\n", timer_ticks.load() - 2, 20ull);
+  PRINT("timed out = %u after %llu us, reached in time = %u\n", timer_timed_out, timer_timeout_waited_ns / 1000, timer_reached);
+  L_ASSERT(timer_timed_out && timer_timeout_waited_ns >= TimerTimeoutNs && "wait_for timed out early");
+  L_ASSERT(timer_reached && "wait_for timed out on a counter that was reached");
+  L_ASSERT(timer_cancelled && "cancel_timed misreported whether a job was still pending");
+  L_ASSERT(timer_ticks.load() > 10 && "periodic job missed most of its periods");
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("FIBER STACKS");
+//--------------------------------------------------------------------------------------------
+
+  static lofi::VirtualStackPool<KB(64), 8> trim_stacks;
+  L_ASSERT(trim_stacks.init() && "could not reserve fiber stacks");
+  void* held_stacks[4];
+  for(u64 i = 0; i < 4; i++) {
+    held_stacks[i] = trim_stacks.get_stack();
+    ((volatile u8*)held_stacks[i])[KB(64) - 1] = 1;
+  }
+  trim_stacks.return_stack(held_stacks[2]);
+  trim_stacks.return_stack(held_stacks[3]);
+  trim_stacks.trim();
+  const u64 committed_after_trim = trim_stacks.get_committed_count();
+
+  // fibers keep coming and going while the stacks are trimmed, none of them may go without one
+  std::atomic<u64> stacks_missed{0};
+  std::thread stack_churn([&]() {
+    for(u64 i = 0; i < 20000; i++) {
+      void* a = trim_stacks.get_stack();
+      void* b = trim_stacks.get_stack();
+      stacks_missed += (a == nullptr) + (b == nullptr);
+      if(a) {
+        trim_stacks.return_stack(a);
+      }
+      if(b) {
+        trim_stacks.return_stack(b);
+      }
+    }
+  });
+  for(u64 i = 0; i < 2000; i++) {
+    trim_stacks.trim();
+  }
+  stack_churn.join();
+  trim_stacks.return_stack(held_stacks[0]);
+  trim_stacks.return_stack(held_stacks[1]);
+
+  PRINT("%llu stacks committed after trim, %llu stacks missed while trimming\n", committed_after_trim, stacks_missed.load());
+  L_ASSERT(committed_after_trim == 2 && "trim left free stacks committed or dropped used ones");
+  L_ASSERT(stacks_missed.load() == 0 && "a fiber ran out of stacks while they were trimmed");
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("TASKS");
+//--------------------------------------------------------------------------------------------
+
+  lofi::atomic_counter<> tasks_done{0};
+  GET_THREAD_POOL(task_pool_t)->run();
+  for(u64 i = 0; i < TaskCount; i++) {
+    lofi::spawn<task_pool_t>(task_body(i), lofi::job::Priority::High, &tasks_done);
+  }
+  const u64 tasks_done_before_gate = tasks_done.get_count();
+  task_gate++;
+  while(tasks_done.get_count() < TaskCount) {
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(1ms);
+  }
+  GET_THREAD_POOL(task_pool_t)->terminate();
+
+  PRINT("%llu tasks done, %llu before the gate opened\n", tasks_done.get_count(), tasks_done_before_gate);
+  L_ASSERT(tasks_done_before_gate == 0 && "task ran past a counter it was waiting on");
+  L_ASSERT(task_job_sum.load() == TaskCount * (TaskCount - 1) / 2 && "awaited job did not run");
+  L_ASSERT(task_child_errors.load() == 0 && "child task returned the wrong value");
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("ASYNC FILE");
+//--------------------------------------------------------------------------------------------
+
+  FILE* file_out = fopen(FilePath, "wb");
+  for(u64 i = 0; i < FileSize; i++) {
+    fputc(file_byte(i), file_out);
+  }
+  fclose(file_out);
+
+  file_pool_t::job_node_t file_node{};
+  lofi::atomic_counter<> file_gate{0};
+  lofi::Job file_root;
+  file_root.set_entry_point(file_root_job);
+  file_root.set_job_success(standard_job_success);
+  file_root.set_job_failure(print_job_failure);
+  file_root.set_job_start(0);
+  file_root.set_job_end(1);
+  file_root.set_job_counter(&file_gate);
+  file_node.data = file_root;
+
+  GET_THREAD_POOL(file_pool_t)->push_high_priority_job(0, &file_node);
+  GET_THREAD_POOL(file_pool_t)->run();
+  while(file_gate.get_count() < 1) {
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(10ms);
+  }
+  GET_THREAD_POOL(file_pool_t)->terminate();
+  remove(FilePath);
+
+  for(u32 pass = 0; pass < 2; pass++) {
+    PRINT("%s: %llu mismatches, %u of %llu chunks batched, read at the end got %lli bytes\n",
+        file_backends[pass] == lofi::io::Backend::Uring ? "io_uring" : "io threads",
+        file_mismatches[pass], file_batched[pass], FileChunks, file_tail_read[pass]);
+    L_ASSERT(file_mismatches[pass] == 0 && "async read returned the wrong bytes");
+    L_ASSERT(file_batched[pass] == FileChunks && "arena ran out during the batch");
+    L_ASSERT(file_tail_read[pass] == 100 && "read past the end of the file");
+  }
+  L_ASSERT(file_backends[1] == lofi::io::Backend::Threads && "fallback backend did not start");
+
+//--------------------------------------------------------------------------------------------
+  PRINT_TITLE("FRAME ARENAS");
+//--------------------------------------------------------------------------------------------
+
+  frame_pool_t::job_node_t frame_node{};
+  lofi::atomic_counter<> frame_gate{0};
+  lofi::Job frame_root;
+  frame_root.set_entry_point(frame_root_job);
+  frame_root.set_job_success(standard_job_success);
+  frame_root.set_job_failure(print_job_failure);
+  frame_root.set_job_start(0);
+  frame_root.set_job_end(1);
+  frame_root.set_job_counter(&frame_gate);
+  frame_node.data = frame_root;
+
+  GET_THREAD_POOL(frame_pool_t)->push_high_priority_job(0, &frame_node);
+  GET_THREAD_POOL(frame_pool_t)->run();
+  const u64 frame_main_slot = frame_arenas_t::get_slot();
+  for(u64 i = 0; i < FrameMainBlocks; i++) {
+    frame_main_blocks[i] = (u64*)frame_arenas.allocate(0, FrameWords * sizeof(u64), 64);
+    if(frame_main_blocks[i]) {
+      frame_fill(frame_main_blocks[i], MAX_u64 - i);
+    }
+  }
+  frame_main_done.store(true, std::memory_order_release);
+  while(frame_gate.get_count() < 1) {
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(10ms);
+  }
+  GET_THREAD_POOL(frame_pool_t)->terminate();
+
+  PRINT("%llu frames over %llu slots, %llu damaged blocks, %llu frames not reset, main thread slot %llu\n",
+      FramesRun, FrameSlots, frame_errors, frame_unreset, frame_main_slot);
+  L_ASSERT(frame_main_slot == FrameArenaNumThreads && "main thread shares a worker's frame arena");
+  L_ASSERT(GET_THREAD_SLOT(frame_pool_t) == FrameArenaNumThreads && "main thread got a worker's thread slot");
+  L_ASSERT(frame_errors == 0 && "frame arena handed out overlapping or misaligned memory");
+  L_ASSERT(frame_unreset == 0 && "frame slot came around without being reset");
+
 //--------------------------------------------------------------------------------------------
   PRINT_TITLE("Database");
 //--------------------------------------------------------------------------------------------
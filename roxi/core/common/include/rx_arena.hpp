@@ -30,6 +30,10 @@ namespace roxi {
 
   using Arena = lofi::Arena<DefaultArraySize, DefaultAlignment, lofi::mem::SubAllocPolicy>;
 
+  // reserves Cap up front and commits as it grows, never moves
+  template<u64 Cap, u64 Align = DefaultAlignment>
+  using VirtualArena = lofi::Arena<Cap, Align, lofi::mem::VirtualAllocPolicy>;
+
 }		// -----  end of namespace roxi  ----- 
 
 extern template class lofi::Arena<roxi::DefaultArraySize, roxi::DefaultAlignment, lofi::mem::SubAllocPolicy>;
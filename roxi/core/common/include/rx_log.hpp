@@ -184,6 +184,7 @@ namespace roxi {
 
       LogQueue log_queue;
       StackArray<Logger*> loggers;
+      FiberMutex loggers_lock;                // loggers register from any worker
 
     public:
       u32 register_logger(Logger* new_logger);
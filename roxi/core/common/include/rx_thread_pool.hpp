@@ -15,6 +15,8 @@
 // =====================================================================================
 #pragma once
 #include "../../../lofi/core/include/l_thread_pool.hpp"
+#include "../../../lofi/core/include/l_fiber_sync.hpp"
+#include "../../../lofi/core/include/l_task.hpp"
 #include "rx_vocab.h"
 
 #define RX_THREAD_POOL GET_THREAD_POOL(ThreadPool)
@@ -23,6 +25,8 @@
 
 #define RX_THIS_WORKER GET_HOST_WORKER(ThreadPool)
 
+#define RX_CONFIGURE_THREAD_POOL(config) RX_THREAD_POOL->configure(config)
+
 #define RX_RUN_THREAD_POOL() RX_THREAD_POOL->run()
 
 #define RX_KILL_THREAD_POOL() RX_THREAD_POOL->kill()
@@ -33,17 +37,26 @@
 
 #define RX_FIBER_KICK_MID_PRIORITY_JOBS(jobs, job_count) GET_HOST_WORKER(ThreadPool)->kick_mid_priority_jobs((jobs), (job_count))
 
-#define RX_FIBER_KICK_LOW_PRIORITY_JOBS(jobs, job_count) GET_HOST_WORKER(ThreadPool)->kick_high_priority_jobs((jobs), (job_count))
+#define RX_FIBER_KICK_LOW_PRIORITY_JOBS(jobs, job_count) GET_HOST_WORKER(ThreadPool)->kick_low_priority_jobs((jobs), (job_count))
 
 #define RX_FIBER_KICK_HIGH_PRIORITY_JOB(job) GET_HOST_WORKER(ThreadPool)->kick_high_priority_job(job)
 
 #define RX_FIBER_KICK_MID_PRIORITY_JOB(job) GET_HOST_WORKER(ThreadPool)->kick_mid_priority_job(job)
 
-#define RX_FIBER_KICK_LOW_PRIORITY_JOB(job) GET_HOST_WORKER(ThreadPool)->kick_high_priority_job(job)
+#define RX_FIBER_KICK_LOW_PRIORITY_JOB(job) GET_HOST_WORKER(ThreadPool)->kick_low_priority_job(job)
+
+#define RX_FIBER_KICK_PINNED_JOBS(worker_id, jobs, job_count) GET_HOST_WORKER(ThreadPool)->kick_pinned_jobs((worker_id), (jobs), (job_count))
+
+#define RX_FIBER_KICK_PINNED_JOB(worker_id, job) GET_HOST_WORKER(ThreadPool)->kick_pinned_job((worker_id), (job))
 #define RX_FIBER_YIELD() GET_HOST_WORKER(ThreadPool)->yield()
 
 #define RX_SLEEP_FOR(nanoseconds) std::this_thread::sleep_for(std::chrono_literals::operator""ns((u64)(nanoseconds)));
 
+// parks only the calling fiber, the worker keeps running jobs until the timer wheel wakes it
+#define RX_FIBER_SLEEP_FOR(nanoseconds) RX_THREAD_POOL->sleep_for((u64)(nanoseconds))
+
+#define RX_FIBER_WAIT_FOR(counter, wait_count, timeout_ns) RX_THREAD_POOL->wait_for((counter), (wait_count), (u64)(timeout_ns))
+
 #if defined(RX_USE_VK_LOCK_FREE_MEMORY)
 #define RX_FIBER_WAIT(counter, wait_count) GET_HOST_WORKER(ThreadPool)->fiber_wait((counter), (wait_count))
 #else
@@ -58,8 +71,20 @@ namespace roxi {
 
   using Counter = lofi::atomic_counter<>;
 
+  // park the fiber instead of spinning the worker while the lock is held
+  using FiberMutex = lofi::fiber_mutex<ThreadPool>;
+  using FiberSemaphore = lofi::fiber_semaphore<ThreadPool>;
+  using FiberConditionVariable = lofi::fiber_condition_variable<ThreadPool>;
+
   using Job = lofi::Job;
 
+  // delayed and periodic kicks, see ThreadPool::kick_delayed and kick_periodic
+  using TimedJob = ThreadPool::timed_job;
+
+  // coroutines resumed as plain jobs, co_await lofi::wait<ThreadPool> / lofi::kick<ThreadPool>
+  template<typename T = void>
+  using Task = lofi::task<T>;
+
   //template<class TableDescriptorT>
   //using Database = lofi::Database<TableDescriptorT>;
 
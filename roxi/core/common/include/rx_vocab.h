@@ -31,7 +31,10 @@ namespace roxi {
   static constexpr u64 DefaultArraySize        =  MAX_u32 - 1;
 
   static constexpr u64 DefaultAlignment        =        8;
+  // most workers the pool can run, how many it starts with is picked at run time
   static constexpr u64 RoxiNumThreads          =        4;
+  // frame lifetime bytes each worker can hand out per frame in flight
+  static constexpr u64 RoxiFrameArenaSize      =    MB(1);
 
   template<typename... Ts>
   using List = lofi::List<Ts...>;
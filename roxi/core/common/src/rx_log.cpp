@@ -47,8 +47,10 @@ namespace roxi {
   }
 
   u32 LogSystem::register_logger(Logger* new_logger) {
+    loggers_lock.lock();
     const u32 index = loggers.get_size();
     *(loggers.push(1)) = new_logger;
+    loggers_lock.unlock();
     return index;
   }
 
@@ -65,6 +67,7 @@ namespace roxi {
   }
 
   void LogSystem::dump_logs() {
+    loggers_lock.lock();
     for(size_t i = 0; i < loggers.get_size(); i++) {
       StringList list = loggers[i]->retrieve_logs();
       log_queue.enqueue(&list);
@@ -75,6 +78,7 @@ namespace roxi {
       fclose(file);
       file = nullptr;
     }
+    loggers_lock.unlock();
   }
 
 }		// -----  end of namespace roxi  ----- 
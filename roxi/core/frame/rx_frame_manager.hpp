@@ -15,15 +15,21 @@
 // =====================================================================================
 #pragma once
 #include "rx_thread_pool.hpp"
+#include "../../../lofi/core/include/l_frame_arena.hpp"
 
 namespace roxi {
   namespace frame {
     using ID = u64;
   }		// -----  end of namespace frame  ----- 
  
+  // besides the frame counters, every frame in flight has a linear arena per worker and one
+  // for the main thread. frame lifetime data is a pointer bump on the caller's arena and is
+  // never freed on its own, the frame's arenas are reset together once the frame is retired
   class FrameManager {
   private:
+    using transient_arenas_t = lofi::FrameArenas<ThreadPool, RoxiNumFrames, RoxiNumThreads, RoxiFrameArenaSize>;
     Counter _frames[RoxiNumFrames];
+    transient_arenas_t _transient;
   public:
 
     const u64 get_frame_count(frame::ID id) {
@@ -41,9 +47,37 @@ namespace roxi {
       return _frames[id];
     }
 
+    // also drops everything allocated for the frame, nothing may still be using it
     void reset_frame(frame::ID id) {
       id &= RoxiNumFrames - 1;
       _frames[id].reset();
+      _transient.reset(id);
+    }
+
+    // resets the frame once its counter reached target, the slot is then free for the frame
+    // RoxiNumFrames ahead
+    b8 retire_frame(frame::ID id, const u64 target) {
+      if(get_frame_count(id) < target) {
+        return false;
+      }
+      reset_frame(id);
+      return true;
+    }
+
+    // memory that lives until frame id is retired, taken from the calling worker's arena or
+    // the main thread's. nullptr once that arena is full for this frame
+    void* allocate_transient(frame::ID id, const u64 size, const u64 alignment = DefaultAlignment) {
+      return _transient.allocate(id, size, alignment);
+    }
+
+    template<typename T>
+    T* allocate_transient(frame::ID id, const u64 count = 1) {
+      return (T*)allocate_transient(id, sizeof(T) * count, alignof(T));
+    }
+
+    // bytes handed out for frame id over all threads, padding included
+    const u64 get_transient_size(frame::ID id) const {
+      return _transient.get_size(id);
     }
 
   };
@@ -262,6 +262,10 @@ namespace roxi {
           RX_ERRORF("system %u failed to update", i);
           br = true;
         }
+        // the update is the frame's only job and ran inline, failed or not it is finished, so
+        // the frame is retired here and its slot is free for the frame RoxiNumFrames ahead
+        _frame_manager.update_frame(frame_id);
+        _frame_manager.retire_frame(frame_id, 1);
         frame_id++;
       }
       if(br) {